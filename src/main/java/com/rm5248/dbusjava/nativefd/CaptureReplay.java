@@ -0,0 +1,322 @@
+package com.rm5248.dbusjava.nativefd;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.MappedByteBuffer;
+import java.nio.channels.FileChannel;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.nio.file.StandardOpenOption;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.Comparator;
+import java.util.List;
+
+import org.freedesktop.dbus.FileDescriptor;
+import org.freedesktop.dbus.exceptions.DBusException;
+import org.freedesktop.dbus.messages.Message;
+import org.slf4j.Logger;
+import org.slf4j.LoggerFactory;
+
+import jnr.constants.platform.AddressFamily;
+import jnr.constants.platform.OpenFlags;
+import jnr.constants.platform.Sock;
+import jnr.posix.POSIXFactory;
+
+/**
+ * Replays a capture that was made by setting a capture directory on the
+ * NativeSocketProvider.
+ *
+ * All of the messages that the connection received are written into one end
+ * of a socketpair and read back through a NativeMessageReader, either at the
+ * speed that they were originally received at or as fast as possible.
+ * Messages that carried file descriptors are sent with the same number of
+ * file descriptors(opened to /dev/null).
+ *
+ * Usage: CaptureReplay [--max-speed] [--repeat N] capture-file
+ */
+public class CaptureReplay {
+
+    private static jnr.posix.POSIX POSIX = POSIXFactory.getPOSIX();
+    private static final Logger logger = LoggerFactory.getLogger( CaptureReplay.class );
+
+    private static final String FILE_MAGIC = "DBJCAP01";
+    private static final int VERSION = 1;
+    private static final int RECORD_MAGIC = 0x52504143;
+    private static final int PAD_MAGIC = 0x44415043;
+    private static final int RECORD_HEADER_SIZE = 32;
+
+    public static final int DIRECTION_RX = 0;
+    public static final int DIRECTION_TX = 1;
+
+    /**
+     * One message from a capture file.
+     */
+    public static class Record {
+        private final long m_sequence;
+        private final long m_timestampNs;
+        private final int m_direction;
+        private final int m_numFds;
+        private final byte[] m_data;
+
+        Record( long sequence, long timestampNs, int direction, int numFds, byte[] data ){
+            m_sequence = sequence;
+            m_timestampNs = timestampNs;
+            m_direction = direction;
+            m_numFds = numFds;
+            m_data = data;
+        }
+
+        public long getSequence(){
+            return m_sequence;
+        }
+
+        /**
+         * @return The CLOCK_MONOTONIC time the message was captured at, in nanoseconds
+         */
+        public long getTimestampNs(){
+            return m_timestampNs;
+        }
+
+        /**
+         * @return DIRECTION_RX or DIRECTION_TX
+         */
+        public int getDirection(){
+            return m_direction;
+        }
+
+        public int getNumFds(){
+            return m_numFds;
+        }
+
+        public byte[] getData(){
+            return m_data;
+        }
+    }
+
+    /**
+     * Read all of the messages that are still in the given capture file.
+     *
+     * @param captureFile The capture file to read
+     * @return The messages, oldest first
+     * @throws IOException If the file can't be read or is not a capture file
+     */
+    public static List<Record> readCapture( Path captureFile ) throws IOException {
+        List<Record> records = new ArrayList<Record>();
+        MappedByteBuffer file;
+
+        try( FileChannel channel = FileChannel.open( captureFile, StandardOpenOption.READ ) ){
+            file = channel.map( FileChannel.MapMode.READ_ONLY, 0, channel.size() );
+        }
+        file.order( ByteOrder.nativeOrder() );
+
+        byte[] magic = new byte[ 8 ];
+        file.get( magic );
+        if( !FILE_MAGIC.equals( new String( magic, StandardCharsets.US_ASCII ) ) ){
+            throw new IOException( captureFile + " is not a capture file" );
+        }
+        if( file.getInt( 8 ) != VERSION ){
+            throw new IOException( "Unsupported capture version " + file.getInt( 8 ) );
+        }
+
+        int headerSize = file.getInt( 12 );
+        long capacity = file.getLong( 16 );
+        long head = file.getLong( 24 );
+        if( capacity <= 0 || capacity > Integer.MAX_VALUE - headerSize ){
+            throw new IOException( "Unsupported capture size " + capacity );
+        }
+        if( headerSize + capacity > file.capacity() ){
+            throw new IOException( captureFile + " is truncated" );
+        }
+
+        file.position( headerSize );
+        ByteBuffer data = file.slice().order( ByteOrder.nativeOrder() );
+
+        // Once the ring has wrapped, the oldest data starts at the head.  The record
+        // there may be partially overwritten, so step over anything that isn't a record.
+        int pos = (int)( head > capacity ? head % capacity : 0 );
+        long remaining = Math.min( head, capacity );
+        while( remaining > 0 ){
+            int recordMagic = data.getInt( pos );
+            int recordLen = data.getInt( pos + 4 );
+            int step = 8;
+
+            if( recordMagic == PAD_MAGIC && recordLen > 0 && pos + recordLen <= capacity ){
+                step = recordLen;
+            } else if( recordMagic == RECORD_MAGIC && recordLen >= RECORD_HEADER_SIZE
+                    && pos + recordLen <= capacity ){
+                int dataLen = data.getInt( pos + 24 );
+                if( RECORD_HEADER_SIZE + dataLen <= recordLen ){
+                    byte[] message = new byte[ dataLen ];
+                    ByteBuffer view = data.duplicate();
+                    view.position( pos + RECORD_HEADER_SIZE );
+                    view.get( message );
+
+                    records.add( new Record( data.getLong( pos + 8 ),
+                            data.getLong( pos + 16 ),
+                            data.getShort( pos + 28 ) & 0xFFFF,
+                            data.getShort( pos + 30 ) & 0xFFFF,
+                            message ) );
+                    step = recordLen;
+                }
+            }
+
+            remaining -= step;
+            pos = (int)( ( pos + step ) % capacity );
+        }
+
+        records.sort( Comparator.comparingLong( Record::getSequence ) );
+
+        return records;
+    }
+
+    /**
+     * Feed the received messages from a capture through a NativeMessageReader.
+     *
+     * @param records The messages from the capture
+     * @param maxSpeed True to send the messages as fast as possible, false
+     * to send them with the same timing that they were captured with
+     * @return The number of messages read
+     * @throws IOException
+     * @throws InterruptedException
+     */
+    public static int replay( List<Record> records, boolean maxSpeed ) throws IOException, InterruptedException {
+        int[] sockets = { 0, 0 };
+        List<Record> received = new ArrayList<Record>();
+        Throwable[] writeError = { null };
+
+        for( Record r : records ){
+            if( r.getDirection() == DIRECTION_RX ){
+                received.add( r );
+            }
+        }
+
+        if( received.isEmpty() ){
+            return 0;
+        }
+
+        if( POSIX.socketpair( AddressFamily.AF_UNIX.intValue(), Sock.SOCK_STREAM.intValue(), 0, sockets ) < 0 ){
+            throw new IOException( "Unable to create socketpair: " + POSIX.strerror( POSIX.errno() ) );
+        }
+
+        int devNull = POSIX.open( "/dev/null", OpenFlags.O_RDONLY.intValue(), 0 );
+        if( devNull < 0 ){
+            String error = POSIX.strerror( POSIX.errno() );
+            POSIX.close( sockets[ 0 ] );
+            POSIX.close( sockets[ 1 ] );
+            throw new IOException( "Unable to open /dev/null: " + error );
+        }
+
+        NativeSocketProvider.ensureNativeLibraryLoaded();
+        NativeMessageWriter writer = new NativeMessageWriter( sockets[ 0 ] );
+        NativeMessageReader reader = new NativeMessageReader( sockets[ 1 ] );
+
+        Thread writerThread = new Thread( () -> {
+            long firstTimestamp = received.get( 0 ).getTimestampNs();
+            long start = System.nanoTime();
+
+            try{
+                for( Record r : received ){
+                    if( !maxSpeed ){
+                        long delay = ( r.getTimestampNs() - firstTimestamp ) - ( System.nanoTime() - start );
+                        if( delay > 0 ){
+                            Thread.sleep( delay / 1000000, (int)( delay % 1000000 ) );
+                        }
+                    }
+
+                    int[] fds = new int[ r.getNumFds() ];
+                    Arrays.fill( fds, devNull );
+                    writer.writeRaw( r.getData(), fds );
+                }
+            } catch( IOException | InterruptedException e ){
+                writeError[ 0 ] = e;
+                // Close our end, so that the reader gets EOF instead of
+                // waiting forever for the rest of the messages
+                try{
+                    writer.close();
+                } catch( IOException closeError ){
+                    e.addSuppressed( closeError );
+                }
+            }
+        }, "CaptureReplay-writer" );
+
+        int numRead = 0;
+        try{
+            writerThread.setDaemon( true );
+            writerThread.start();
+
+            for( ; numRead < received.size(); numRead++ ){
+                Message m;
+                try{
+                    m = reader.readMessage();
+                } catch( DBusException e ){
+                    throw new IOException( "Unable to parse message " + received.get( numRead ).getSequence(), e );
+                } catch( IOException e ){
+                    // If the writer failed, that is why we ran out of messages
+                    writerThread.join();
+                    if( writeError[ 0 ] != null ){
+                        throw new IOException( "Unable to write messages", writeError[ 0 ] );
+                    }
+                    throw e;
+                }
+
+                for( FileDescriptor fd : m.getFiledescriptors() ){
+                    POSIX.close( fd.getIntFileDescriptor() );
+                }
+            }
+
+            writerThread.join();
+        } finally{
+            writer.close();
+            reader.close();
+            POSIX.close( devNull );
+        }
+
+        if( writeError[ 0 ] != null ){
+            throw new IOException( "Unable to write messages", writeError[ 0 ] );
+        }
+
+        return numRead;
+    }
+
+    public static void main( String[] args ) throws Exception {
+        boolean maxSpeed = false;
+        int repeat = 1;
+        Path captureFile = null;
+
+        for( int x = 0; x < args.length; x++ ){
+            if( args[ x ].equals( "--max-speed" ) ){
+                maxSpeed = true;
+            } else if( args[ x ].equals( "--repeat" ) && x + 1 < args.length ){
+                repeat = Integer.parseInt( args[ ++x ] );
+            } else{
+                captureFile = Paths.get( args[ x ] );
+            }
+        }
+
+        if( captureFile == null ){
+            System.err.println( "Usage: CaptureReplay [--max-speed] [--repeat N] capture-file" );
+            System.exit( 1 );
+        }
+
+        List<Record> records = readCapture( captureFile );
+        long bytes = 0;
+        for( Record r : records ){
+            if( r.getDirection() == DIRECTION_RX ){
+                bytes += r.getData().length;
+            }
+        }
+        logger.debug( "Read {} messages from {}", records.size(), captureFile );
+
+        for( int run = 0; run < repeat; run++ ){
+            long start = System.nanoTime();
+            int numRead = replay( records, maxSpeed );
+            double seconds = ( System.nanoTime() - start ) / 1e9;
+
+            System.out.println( String.format( "run %d: %d messages, %d bytes in %.3f s (%.0f msg/s, %.2f MiB/s)",
+                    run, numRead, bytes, seconds, numRead / seconds, bytes / seconds / ( 1024 * 1024 ) ) );
+        }
+    }
+}
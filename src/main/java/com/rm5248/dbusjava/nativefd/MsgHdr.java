@@ -41,12 +41,7 @@ public class MsgHdr {
         m_messages = new ArrayList<byte[]>();
         m_messages.add( data );
 
-        m_fileDescriptors = new ArrayList<FileDescriptor>( fileDescriptors == null ? 1 : fileDescriptors.length );
-        if( fileDescriptors != null ){
-            for( int x = 0; x < fileDescriptors.length; x++ ){
-                m_fileDescriptors.add( new FileDescriptor( fileDescriptors[ x ] ) );
-            }
-        }
+        m_fileDescriptors = new ReceivedFileDescriptors( fileDescriptors );
     }
 
     public void addMessageToSend( byte[] msg ){
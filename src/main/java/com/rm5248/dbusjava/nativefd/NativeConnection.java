@@ -0,0 +1,67 @@
+package com.rm5248.dbusjava.nativefd;
+
+/**
+ * The native reader and writer that a NativeSocketProvider created for one socket.
+ */
+public class NativeConnection {
+
+    private final int m_fd;
+    private NativeMessageReader m_reader;
+    private NativeMessageWriter m_writer;
+    private String m_capturePath;
+
+    NativeConnection( int fd ){
+        m_fd = fd;
+    }
+
+    /**
+     * @return The file descriptor of the socket
+     */
+    public int getFileDescriptor(){
+        return m_fd;
+    }
+
+    /**
+     * @return The reader for this connection, or null if it has not been created yet
+     */
+    public synchronized NativeMessageReader getReader(){
+        return m_reader;
+    }
+
+    /**
+     * @return The writer for this connection, or null if it has not been created yet
+     */
+    public synchronized NativeMessageWriter getWriter(){
+        return m_writer;
+    }
+
+    /**
+     * @return True if both the reader and the writer of this connection have been closed
+     */
+    public synchronized boolean isClosed(){
+        return ( m_reader == null || m_reader.isClosed() )
+                && ( m_writer == null || m_writer.isClosed() )
+                && ( m_reader != null || m_writer != null );
+    }
+
+    synchronized void setReader( NativeMessageReader reader ){
+        m_reader = reader;
+    }
+
+    synchronized void setWriter( NativeMessageWriter writer ){
+        m_writer = writer;
+    }
+
+    synchronized String getCapturePath(){
+        return m_capturePath;
+    }
+
+    synchronized void setCapturePath( String capturePath ){
+        m_capturePath = capturePath;
+    }
+
+    @Override
+    public String toString(){
+        return "NativeConnection[fd=" + m_fd + "]";
+    }
+}
@@ -0,0 +1,153 @@
+package com.rm5248.dbusjava.nativefd;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.Collections;
+import java.util.List;
+import java.util.concurrent.atomic.AtomicInteger;
+
+import org.freedesktop.dbus.connections.impl.DBusConnection;
+import org.freedesktop.dbus.connections.impl.DBusConnection.DBusBusType;
+import org.freedesktop.dbus.exceptions.DBusException;
+import org.freedesktop.dbus.interfaces.DBusInterface;
+import org.slf4j.Logger;
+import org.slf4j.LoggerFactory;
+
+/**
+ * A pool of connections to the same bus, so that calls from many threads are
+ * spread out over several sockets instead of queueing behind one.
+ *
+ * Each thread is always given the same connection(its shard), so the calls
+ * that a single thread makes stay in order.  Note that each connection in the
+ * pool has its own unique bus name, so objects and bus names should be
+ * exported on a connection of their own rather than through the pool.
+ */
+public class NativeConnectionPool implements Closeable {
+
+    private static final Logger logger = LoggerFactory.getLogger( NativeConnectionPool.class );
+
+    private final DBusConnection[] m_connections;
+    private final AtomicInteger m_nextShard;
+    private final ThreadLocal<Integer> m_threadShard;
+
+    /**
+     * Create a pool with one connection per available processor.
+     *
+     * @param busType The bus to connect to
+     * @throws DBusException If a connection can't be made
+     */
+    public NativeConnectionPool( DBusBusType busType ) throws DBusException {
+        this( busType, Runtime.getRuntime().availableProcessors() );
+    }
+
+    /**
+     * Create a pool of connections.
+     *
+     * @param busType The bus to connect to
+     * @param numConnections The number of connections to make to the bus
+     * @throws DBusException If a connection can't be made
+     */
+    public NativeConnectionPool( DBusBusType busType, int numConnections ) throws DBusException {
+        if( numConnections < 1 ){
+            throw new IllegalArgumentException( "Need at least one connection" );
+        }
+
+        m_connections = new DBusConnection[ numConnections ];
+        m_nextShard = new AtomicInteger();
+        m_threadShard = ThreadLocal.withInitial(
+                () -> Math.floorMod( m_nextShard.getAndIncrement(), m_connections.length ) );
+        try{
+            for( int x = 0; x < numConnections; x++ ){
+                m_connections[ x ] = DBusConnection.newConnection( busType );
+            }
+        } catch( DBusException e ){
+            try{
+                close();
+            } catch( IOException closeError ){
+                e.addSuppressed( closeError );
+            }
+            throw e;
+        }
+
+        logger.debug( "Created pool of {} connections to the {} bus", numConnections, busType );
+    }
+
+    /**
+     * @return The number of connections in this pool
+     */
+    public int size(){
+        return m_connections.length;
+    }
+
+    /**
+     * @return All of the connections in this pool
+     */
+    public List<DBusConnection> getConnections(){
+        return Collections.unmodifiableList( Arrays.asList( m_connections ) );
+    }
+
+    /**
+     * Get the connection that the calling thread should use.  Threads are
+     * assigned to connections round-robin the first time that they ask.
+     *
+     * @return The connection for the calling thread
+     */
+    public DBusConnection getConnection(){
+        return m_connections[ m_threadShard.get() ];
+    }
+
+    /**
+     * Get the connection for the given key, so that all requests for the
+     * same key(e.g. a session or a remote object) go out over the same connection.
+     *
+     * @param key The key to pick a connection for
+     * @return The connection to use for the key
+     */
+    public DBusConnection getConnection( Object key ){
+        int hash = key.hashCode();
+
+        // Spread out the bits, as hash codes are often sequential
+        hash ^= hash >>> 16;
+        hash *= 0x45d9f3b;
+        hash ^= hash >>> 16;
+
+        return m_connections[ Math.floorMod( hash, m_connections.length ) ];
+    }
+
+    /**
+     * Get a remote object through the calling thread's connection.
+     *
+     * @see DBusConnection#getRemoteObject(String, String, Class)
+     */
+    public <T extends DBusInterface> T getRemoteObject( String busname, String objectpath, Class<T> type ) throws DBusException {
+        return getConnection().getRemoteObject( busname, objectpath, type );
+    }
+
+    /**
+     * Disconnect all of the connections in this pool.
+     */
+    @Override
+    public void close() throws IOException {
+        List<IOException> errors = new ArrayList<IOException>();
+
+        for( DBusConnection connection : m_connections ){
+            if( connection == null ){
+                continue;
+            }
+
+            try{
+                connection.close();
+            } catch( IOException e ){
+                errors.add( e );
+            }
+        }
+
+        if( !errors.isEmpty() ){
+            IOException ex = new IOException( "Unable to close all connections" );
+            errors.forEach( ex::addSuppressed );
+            throw ex;
+        }
+    }
+}
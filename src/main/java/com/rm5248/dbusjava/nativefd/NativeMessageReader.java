@@ -26,12 +26,25 @@ public class NativeMessageReader implements IMessageReader {
     private static final Logger logger_native = LoggerFactory.getLogger( NativeMessageReader.class.getName() + ".native" );
 
     private int m_fd;
-    private boolean m_isClosed;
+    private volatile boolean m_isClosed;
     private int m_nativeHandle;
+    private final boolean m_closeSocket;
+    private Runnable m_closeListener;
 
     public NativeMessageReader( int fd ){
+        this( fd, true );
+    }
+
+    /**
+     * @param fd The socket to use
+     * @param closeSocket True to close the socket when this reader is closed,
+     * false if it belongs to someone else, e.g. the channel that the
+     * NativeSocketProvider was given
+     */
+    NativeMessageReader( int fd, boolean closeSocket ){
         m_fd = fd;
         m_isClosed = false;
+        m_closeSocket = closeSocket;
         m_nativeHandle = openNativeHandle( m_fd );
     }
 
@@ -45,7 +58,7 @@ public class NativeMessageReader implements IMessageReader {
         int messageBodyLen;
         int headerArrayLen;
         int totalMessageLen;
-        MsgHdr h = readNative( m_nativeHandle );
+        MsgHdr h = readMsgHdr();
         logger.debug( "Got the data" );
         ByteBuffer inData = ByteBuffer.wrap( h.getMessages().get( 0 ) );
 
@@ -111,14 +124,94 @@ public class NativeMessageReader implements IMessageReader {
         return m;
     }
 
+    /**
+     * Read the raw data of the next message, without parsing it.
+     */
+    MsgHdr readMsgHdr() throws IOException {
+        if( m_isClosed ){
+            throw new IOException( "Reader is closed" );
+        }
+        return readNative( m_nativeHandle );
+    }
+
     @Override
     public void close() throws IOException {
-        if( m_isClosed ) return;
-        m_isClosed = true;
-        POSIX.close( m_fd );
+        synchronized( this ){
+            if( m_isClosed ) return;
+            m_isClosed = true;
+        }
+
+        // This wakes up a thread that is blocked in the native code, and
+        // waits for it to be done with the handle before freeing it
+        closeNativeHandle( m_nativeHandle );
+
+        // Only close the socket once nothing can use it through our handle,
+        // as its number may be given to another connection right away
+        if( m_closeSocket ){
+            POSIX.close( m_fd );
+        }
+        if( m_closeListener != null ){
+            m_closeListener.run();
+        }
+    }
+
+    /**
+     * Free the native resources of this reader without closing the socket, for
+     * when it could not be set up and is never handed out.
+     */
+    void release(){
+        synchronized( this ){
+            if( m_isClosed ) return;
+            m_isClosed = true;
+        }
         closeNativeHandle( m_nativeHandle );
     }
 
+    /**
+     * Set a callback that is called once this reader has been closed.
+     */
+    void setCloseListener( Runnable closeListener ){
+        m_closeListener = closeListener;
+    }
+
+    /**
+     * Start capturing all of the messages that go through this reader
+     * into the given capture file.  The reader and writer of a connection
+     * should be given the same file.
+     *
+     * @param capturePath The file to capture to
+     * @param captureSize The size of the capture ring in bytes
+     * @throws IOException If the capture file can't be created
+     */
+    void startCapture( String capturePath, long captureSize ) throws IOException {
+        openCapture( m_nativeHandle, capturePath, captureSize );
+    }
+
+    /**
+     * Pin the thread that reads from this connection to the given CPUs.  The
+     * thread is pinned the first time that it calls into the native code;
+     * dbus-java reads each connection from a thread of its own.
+     *
+     * @param cpus The CPUs to pin to, or null to not pin
+     * @param numaLocal True to allocate our buffers on the NUMA node of the CPUs
+     */
+    void setAffinity( int[] cpus, boolean numaLocal ){
+        setAffinity( m_nativeHandle, cpus, numaLocal );
+    }
+
+    /**
+     * Sample the socket queue and stall time of this reader.
+     *
+     * @return The number of queued bytes and the nanoseconds since the last message was returned, or null if this reader is closed
+     */
+    long[] sample(){
+        if( m_isClosed ){
+            return null;
+        }
+        // Returns null if we are closed in the meantime
+        return sampleNative( m_nativeHandle );
+    }
+
     /**
      * Given a filedescriptor, return a native handle to native data.
      * @param fd
@@ -128,6 +221,12 @@ public class NativeMessageReader implements IMessageReader {
 
     private native void closeNativeHandle( int handle );
 
+    private native void openCapture( int handle, String capturePath, long captureSize ) throws IOException;
+
+    private native void setAffinity( int handle, int[] cpus, boolean numaLocal );
+
+    private native long[] sampleNative( int handle );
+
     private native MsgHdr readNative( int handle ) throws IOException;
 
 }
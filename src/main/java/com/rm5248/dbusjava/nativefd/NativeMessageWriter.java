@@ -22,12 +22,25 @@ public class NativeMessageWriter implements IMessageWriter {
     private static final Logger logger_native = LoggerFactory.getLogger( NativeMessageReader.class.getName() + ".native" );
 
     private int m_fd;
-    private boolean m_isClosed;
+    private volatile boolean m_isClosed;
     private int m_nativeHandle;
+    private final boolean m_closeSocket;
+    private Runnable m_closeListener;
 
     public NativeMessageWriter( int fd ){
+        this( fd, true );
+    }
+
+    /**
+     * @param fd The socket to use
+     * @param closeSocket True to close the socket when this writer is closed,
+     * false if it belongs to someone else, e.g. the channel that the
+     * NativeSocketProvider was given
+     */
+    NativeMessageWriter( int fd, boolean closeSocket ){
         m_fd = fd;
         m_isClosed = false;
+        m_closeSocket = closeSocket;
         m_nativeHandle = openNativeHandle( m_fd );
     }
 
@@ -39,6 +52,10 @@ public class NativeMessageWriter implements IMessageWriter {
 
         logger.debug("<= {}", m);
 
+        if( m_isClosed ){
+            throw new IOException( "Writer is closed" );
+        }
+
         if (null == m.getWireData()) {
             logger.warn("Message {} wire-data was null!", m);
             return;
@@ -58,6 +75,20 @@ public class NativeMessageWriter implements IMessageWriter {
         writeNative( m_nativeHandle, bos.toByteArray(), fds );
     }
 
+    /**
+     * Write already marshalled message data directly to the socket.
+     *
+     * @param msgdata The raw bytes of the message
+     * @param filedescriptors The file descriptors to send along with the message
+     * @throws IOException
+     */
+    void writeRaw( byte[] msgdata, int[] filedescriptors ) throws IOException {
+        if( m_isClosed ){
+            throw new IOException( "Writer is closed" );
+        }
+        writeNative( m_nativeHandle, msgdata, filedescriptors );
+    }
+
     @Override
     public boolean isClosed() {
         return m_isClosed;
@@ -65,12 +96,82 @@ public class NativeMessageWriter implements IMessageWriter {
 
     @Override
     public void close() throws IOException {
-        if( m_isClosed ) return;
-        m_isClosed = true;
-        POSIX.close( m_fd );
+        synchronized( this ){
+            if( m_isClosed ) return;
+            m_isClosed = true;
+        }
+
+        // This wakes up a thread that is blocked in the native code, and
+        // waits for it to be done with the handle before freeing it
+        closeNativeHandle( m_nativeHandle );
+
+        // Only close the socket once nothing can use it through our handle,
+        // as its number may be given to another connection right away
+        if( m_closeSocket ){
+            POSIX.close( m_fd );
+        }
+        if( m_closeListener != null ){
+            m_closeListener.run();
+        }
+    }
+
+    /**
+     * Free the native resources of this writer without closing the socket, for
+     * when it could not be set up and is never handed out.
+     */
+    void release(){
+        synchronized( this ){
+            if( m_isClosed ) return;
+            m_isClosed = true;
+        }
         closeNativeHandle( m_nativeHandle );
     }
 
+    /**
+     * Set a callback that is called once this writer has been closed.
+     */
+    void setCloseListener( Runnable closeListener ){
+        m_closeListener = closeListener;
+    }
+
+    /**
+     * Start capturing all of the messages that go through this writer
+     * into the given capture file.  The reader and writer of a connection
+     * should be given the same file.
+     *
+     * @param capturePath The file to capture to
+     * @param captureSize The size of the capture ring in bytes
+     * @throws IOException If the capture file can't be created
+     */
+    void startCapture( String capturePath, long captureSize ) throws IOException {
+        openCapture( m_nativeHandle, capturePath, captureSize );
+    }
+
+    /**
+     * Set the CPUs that the I/O of this connection runs on.  Messages are sent
+     * from application threads, so the writer never pins the calling thread;
+     * the CPUs are only used to place our buffers.
+     *
+     * @param cpus The CPUs of the connection, or null if it is not pinned
+     * @param numaLocal True to allocate our buffers on the NUMA node of the CPUs
+     */
+    void setAffinity( int[] cpus, boolean numaLocal ){
+        setAffinity( m_nativeHandle, cpus, numaLocal );
+    }
+
+    /**
+     * Sample the socket queue and stall time of this writer.
+     *
+     * @return The number of queued bytes and the nanoseconds blocked in sendmsg, or null if this writer is closed
+     */
+    long[] sample(){
+        if( m_isClosed ){
+            return null;
+        }
+        // Returns null if we are closed in the meantime
+        return sampleNative( m_nativeHandle );
+    }
+
     /**
      * Given a filedescriptor, return a native handle to native data.
      * @param fd
@@ -80,6 +181,12 @@ public class NativeMessageWriter implements IMessageWriter {
 
     private native void closeNativeHandle( int handle );
 
+    private native void openCapture( int handle, String capturePath, long captureSize ) throws IOException;
+
+    private native void setAffinity( int handle, int[] cpus, boolean numaLocal );
+
+    private native long[] sampleNative( int handle );
+
     private native void writeNative( int handle, byte[] msgdata, int[] filedescriptors ) throws IOException;
 
 }
@@ -0,0 +1,150 @@
+package com.rm5248.dbusjava.nativefd;
+
+import java.io.Closeable;
+import java.util.Collections;
+import java.util.HashSet;
+import java.util.List;
+import java.util.Set;
+import java.util.concurrent.CopyOnWriteArrayList;
+import java.util.concurrent.Executors;
+import java.util.concurrent.ScheduledExecutorService;
+import java.util.concurrent.TimeUnit;
+import java.util.function.Supplier;
+
+import org.slf4j.Logger;
+import org.slf4j.LoggerFactory;
+
+/**
+ * Periodically samples the socket queues of all of the connections of a
+ * NativeSocketProvider, and tells listeners when a connection falls behind.
+ *
+ * A connection is stalled when either of its socket queues reaches the queue
+ * threshold, when data is waiting to be read but nobody has asked the reader
+ * for a message for longer than the stall threshold, or when the writer has
+ * been blocked sending one message for longer than the stall threshold.
+ */
+public class NativeQueueMonitor implements Closeable {
+
+    private static final Logger logger = LoggerFactory.getLogger( NativeQueueMonitor.class );
+
+    private final Supplier<List<QueueGauges>> m_sampler;
+    private final long m_queueBytesThreshold;
+    private final long m_stallNanosThreshold;
+    private final List<QueueStallListener> m_listeners;
+    private final Set<NativeConnection> m_stalled;
+    private ScheduledExecutorService m_executor;
+    private volatile List<QueueGauges> m_lastGauges;
+
+    /**
+     * Start sampling the connections of the given provider.
+     *
+     * @param provider The provider to sample the connections of
+     * @param period How often to sample
+     * @param unit The unit of period
+     * @param queueBytesThreshold The number of queued bytes in either direction
+     * that counts as stalled, or 0 to not check the queue size
+     * @param stallThreshold How long the reader or writer may go without progress,
+     * or 0 to not check for stalled readers and writers
+     * @param stallUnit The unit of stallThreshold
+     */
+    public NativeQueueMonitor( NativeSocketProvider provider, long period, TimeUnit unit,
+            long queueBytesThreshold, long stallThreshold, TimeUnit stallUnit ){
+        this( provider::sampleQueues, queueBytesThreshold, stallUnit.toNanos( stallThreshold ) );
+
+        m_executor = Executors.newSingleThreadScheduledExecutor( r -> {
+            Thread t = new Thread( r, "NativeQueueMonitor" );
+            t.setDaemon( true );
+            return t;
+        } );
+
+        m_executor.scheduleAtFixedRate( this::sample, period, period, unit );
+    }
+
+    /**
+     * Create a monitor that only samples when {@link #sample()} is called.
+     *
+     * @param sampler Where to get the gauges from
+     * @param queueBytesThreshold The number of queued bytes that counts as stalled, or 0
+     * @param stallNanosThreshold How long the reader or writer may go without progress, or 0
+     */
+    NativeQueueMonitor( Supplier<List<QueueGauges>> sampler, long queueBytesThreshold, long stallNanosThreshold ){
+        m_sampler = sampler;
+        m_queueBytesThreshold = queueBytesThreshold;
+        m_stallNanosThreshold = stallNanosThreshold;
+        m_listeners = new CopyOnWriteArrayList<QueueStallListener>();
+        m_stalled = new HashSet<NativeConnection>();
+        m_lastGauges = Collections.emptyList();
+    }
+
+    public void addListener( QueueStallListener listener ){
+        m_listeners.add( listener );
+    }
+
+    public void removeListener( QueueStallListener listener ){
+        m_listeners.remove( listener );
+    }
+
+    /**
+     * @return The gauges of all of the connections from the last sample
+     */
+    public List<QueueGauges> getGauges(){
+        return m_lastGauges;
+    }
+
+    /**
+     * Stop sampling.
+     */
+    @Override
+    public void close(){
+        if( m_executor != null ){
+            m_executor.shutdownNow();
+        }
+    }
+
+    private boolean isStalled( QueueGauges gauges ){
+        if( m_queueBytesThreshold > 0
+                && ( gauges.getReceiveQueueBytes() >= m_queueBytesThreshold
+                    || gauges.getSendQueueBytes() >= m_queueBytesThreshold ) ){
+            return true;
+        }
+
+        if( m_stallNanosThreshold <= 0 ){
+            return false;
+        }
+
+        return ( gauges.getReceiveQueueBytes() > 0 && gauges.getReaderIdleNanos() >= m_stallNanosThreshold )
+                || gauges.getWriterBlockedNanos() >= m_stallNanosThreshold;
+    }
+
+    /**
+     * Take one sample, and tell the listeners about connections that have
+     * stalled or recovered since the last one.
+     */
+    synchronized void sample(){
+        try{
+            List<QueueGauges> gauges = m_sampler.get();
+            Set<NativeConnection> current = new HashSet<NativeConnection>();
+
+            for( QueueGauges g : gauges ){
+                current.add( g.getConnection() );
+
+                if( isStalled( g ) ){
+                    if( m_stalled.add( g.getConnection() ) ){
+                        logger.debug( "Connection stalled: {}", g );
+                        m_listeners.forEach( l -> l.queueStalled( g ) );
+                    }
+                } else if( m_stalled.remove( g.getConnection() ) ){
+                    logger.debug( "Connection recovered: {}", g );
+                    m_listeners.forEach( l -> l.queueRecovered( g ) );
+                }
+            }
+
+            // Forget about connections that have been closed
+            m_stalled.retainAll( current );
+            m_lastGauges = Collections.unmodifiableList( gauges );
+        } catch( RuntimeException e ){
+            // Don't let one bad sample or listener stop the monitor
+            logger.error( "Unable to sample connection queues", e );
+        }
+    }
+}
@@ -1,11 +1,31 @@
 package com.rm5248.dbusjava.nativefd;
 
+import java.io.BufferedReader;
 import java.io.File;
 import java.io.IOException;
 import java.io.InputStream;
 import java.nio.channels.SocketChannel;
+import java.nio.file.FileAlreadyExistsException;
 import java.nio.file.Files;
+import java.nio.file.LinkOption;
 import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.nio.file.StandardCopyOption;
+import java.nio.file.attribute.PosixFilePermission;
+import java.nio.file.attribute.PosixFilePermissions;
+import java.security.MessageDigest;
+import java.security.NoSuchAlgorithmException;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.Collections;
+import java.util.HashMap;
+import java.util.HashSet;
+import java.util.List;
+import java.util.Map;
+import java.util.Set;
+import java.util.WeakHashMap;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicInteger;
 
 import org.freedesktop.dbus.spi.message.IMessageReader;
 import org.freedesktop.dbus.spi.message.IMessageWriter;
@@ -21,17 +41,71 @@ public class NativeSocketProvider implements org.freedesktop.dbus.spi.message.IS
 
     private static final Logger logger = LoggerFactory.getLogger( NativeSocketProvider.class.getName() );
 
+    /**
+     * The default size of a capture ring, in bytes
+     */
+    public static final long DEFAULT_CAPTURE_SIZE = 16 * 1024 * 1024;
+
+    /**
+     * The largest size of a capture ring, so that a whole capture file can be
+     * mapped by {@link CaptureReplay}
+     */
+    public static final long MAX_CAPTURE_SIZE = 1024 * 1024 * 1024;
+
+    /**
+     * The number of CPUs that a connection can be pinned to(CPU_SETSIZE)
+     */
+    private static final int MAX_CPUS = 1024;
+
+    /**
+     * The /proc/cpuinfo flags that a CPU needs to run the x86-64-v3 build
+     */
+    private static final List<String> X86_64_V3_FLAGS = Arrays.asList(
+            "cx16", "popcnt", "sse4_1", "sse4_2", "ssse3",
+            "avx", "avx2", "bmi1", "bmi2", "f16c", "fma", "abm", "movbe", "xsave" );
+
     static{
         loadNativeLibrary();
     }
 
+    private static final AtomicInteger s_captureCounter = new AtomicInteger();
+    private static final Set<NativeSocketProvider> s_instances =
+            Collections.newSetFromMap( new WeakHashMap<NativeSocketProvider, Boolean>() );
+
     private boolean m_hasFiledescriptorSupport;
-    private NativeMessageReader m_nativeMessageReader;
-    private NativeMessageWriter m_nativeMessageWriter;
+    private final Map<Integer, NativeConnection> m_connections;
+    private File m_captureDirectory;
+    private long m_captureSize;
+    private int[] m_cpuAffinity;
+    private boolean m_numaLocalBuffers;
 
     public NativeSocketProvider(){
         logger.debug( "new NativeSocketProvider" );
+        synchronized( s_instances ){
+            s_instances.add( this );
+        }
         m_hasFiledescriptorSupport = false;
+        m_connections = new HashMap<Integer, NativeConnection>();
+
+        String captureDirectory = System.getProperty( "com.rm5248.dbusnative.capture.path" );
+        if( captureDirectory != null ){
+            m_captureDirectory = new File( captureDirectory );
+        }
+        m_captureSize = Long.getLong( "com.rm5248.dbusnative.capture.size", DEFAULT_CAPTURE_SIZE );
+        if( !isValidCaptureSize( m_captureSize ) ){
+            logger.error( "Invalid capture size {}, using {}", m_captureSize, DEFAULT_CAPTURE_SIZE );
+            m_captureSize = DEFAULT_CAPTURE_SIZE;
+        }
+
+        String cpus = System.getProperty( "com.rm5248.dbusnative.cpus" );
+        if( cpus != null ){
+            try{
+                m_cpuAffinity = parseCpuList( cpus );
+            } catch( IllegalArgumentException e ){
+                logger.error( "Invalid CPU list '{}', not pinning connections: {}", cpus, e.getMessage() );
+            }
+        }
+        m_numaLocalBuffers = Boolean.getBoolean( "com.rm5248.dbusnative.numa.local" );
     }
 
     @Override
@@ -42,8 +116,23 @@ public class NativeSocketProvider implements org.freedesktop.dbus.spi.message.IS
 
         if (_socket instanceof UnixSocketChannel ){
             int fd = ((UnixSocketChannel) _socket).getFD();
-            m_nativeMessageReader = new NativeMessageReader( fd );
-            return m_nativeMessageReader;
+            NativeConnection connection = getConnection( fd, true );
+            NativeMessageReader reader = new NativeMessageReader( fd, false );
+            try{
+                if( m_cpuAffinity != null || m_numaLocalBuffers ){
+                    reader.setAffinity( m_cpuAffinity, m_numaLocalBuffers );
+                }
+                if( m_captureDirectory != null ){
+                    reader.startCapture( getCapturePath( connection ), m_captureSize );
+                }
+            } catch( IOException | RuntimeException e ){
+                reader.release();
+                abandonConnection( connection );
+                throw e;
+            }
+            reader.setCloseListener( () -> connectionClosed( connection ) );
+            connection.setReader( reader );
+            return reader;
         }
 
         return null;
@@ -57,8 +146,23 @@ public class NativeSocketProvider implements org.freedesktop.dbus.spi.message.IS
 
         if (_socket instanceof UnixSocketChannel ){
             int fd = ((UnixSocketChannel) _socket).getFD();
-            m_nativeMessageWriter = new NativeMessageWriter( fd );
-            return m_nativeMessageWriter;
+            NativeConnection connection = getConnection( fd, false );
+            NativeMessageWriter writer = new NativeMessageWriter( fd, false );
+            try{
+                if( m_cpuAffinity != null || m_numaLocalBuffers ){
+                    writer.setAffinity( m_cpuAffinity, m_numaLocalBuffers );
+                }
+                if( m_captureDirectory != null ){
+                    writer.startCapture( getCapturePath( connection ), m_captureSize );
+                }
+            } catch( IOException | RuntimeException e ){
+                writer.release();
+                abandonConnection( connection );
+                throw e;
+            }
+            writer.setCloseListener( () -> connectionClosed( connection ) );
+            connection.setWriter( writer );
+            return writer;
         }
 
         return null;
@@ -74,10 +178,257 @@ public class NativeSocketProvider implements org.freedesktop.dbus.spi.message.IS
         return true;
     }
 
+    /**
+     * Capture the raw traffic of all connections created after this call.
+     *
+     * Each connection is captured into its own ring file in the given
+     * directory, which can be fed back through a NativeMessageReader with
+     * {@link CaptureReplay}.  By default, this is set from the system property
+     * com.rm5248.dbusnative.capture.path(and com.rm5248.dbusnative.capture.size
+     * for the size).
+     *
+     * @param captureDirectory The directory to write captures to, or null to disable capturing
+     * @param captureSize The size of the ring for each connection, in bytes(at most {@link #MAX_CAPTURE_SIZE})
+     * @throws IllegalArgumentException If the size is not positive or is too large
+     */
+    public void setCapture( File captureDirectory, long captureSize ){
+        if( !isValidCaptureSize( captureSize ) ){
+            throw new IllegalArgumentException( "Capture size must be between 1 and " + MAX_CAPTURE_SIZE + " bytes" );
+        }
+        m_captureDirectory = captureDirectory;
+        m_captureSize = captureSize;
+    }
+
+    /**
+     * Pin the native I/O of all connections created after this call to the
+     * given CPUs.
+     *
+     * The thread that reads from a connection is moved onto these CPUs the
+     * first time it calls into the native code.  Threads that send messages
+     * are not pinned, as they belong to the application.  By default, this is
+     * set from the system property com.rm5248.dbusnative.cpus, e.g. "2,3" or "0-3".
+     *
+     * @param cpus The CPUs to pin to, or null to not pin
+     */
+    public void setCpuAffinity( int... cpus ){
+        m_cpuAffinity = cpus == null || cpus.length == 0 ? null : cpus.clone();
+    }
+
+    /**
+     * Allocate the receive and send buffers of connections created after this
+     * call on the NUMA node of the first CPU given to
+     * {@link #setCpuAffinity(int...)}, instead of wherever the allocating
+     * thread happens to run.  This has no effect unless the CPUs are set.  By default, this is set from the
+     * system property com.rm5248.dbusnative.numa.local.
+     *
+     * @param numaLocal True to place buffers on the local NUMA node
+     */
+    public void setNumaLocalBuffers( boolean numaLocal ){
+        m_numaLocalBuffers = numaLocal;
+    }
+
+    /**
+     * Parse a list of CPUs in the same format as /sys/devices/system/cpu/online,
+     * e.g. "0-3,8,10-11".
+     *
+     * @param cpuList The list to parse
+     * @return The CPUs in the list
+     * @throws IllegalArgumentException If the list is empty, or has a CPU or
+     * range that is not valid
+     */
+    static int[] parseCpuList( String cpuList ){
+        List<Integer> cpus = new ArrayList<Integer>();
+
+        for( String range : cpuList.split( "," ) ){
+            range = range.trim();
+            if( range.isEmpty() ){
+                continue;
+            }
+
+            int dash = range.indexOf( '-' );
+            if( dash < 0 ){
+                cpus.add( parseCpu( range ) );
+                continue;
+            }
+
+            int first = parseCpu( range.substring( 0, dash ) );
+            int last = parseCpu( range.substring( dash + 1 ) );
+            if( last < first ){
+                throw new IllegalArgumentException( "CPU range " + range + " is reversed" );
+            }
+            for( int cpu = first; cpu <= last; cpu++ ){
+                cpus.add( cpu );
+            }
+        }
+
+        if( cpus.isEmpty() ){
+            throw new IllegalArgumentException( "No CPUs given" );
+        }
+
+        return cpus.stream().mapToInt( Integer::intValue ).toArray();
+    }
+
+    private static int parseCpu( String cpu ){
+        int value;
+
+        try{
+            value = Integer.parseInt( cpu.trim() );
+        } catch( NumberFormatException e ){
+            throw new IllegalArgumentException( "'" + cpu.trim() + "' is not a CPU number" );
+        }
+
+        if( value < 0 || value >= MAX_CPUS ){
+            throw new IllegalArgumentException( "CPU " + value + " is not between 0 and " + ( MAX_CPUS - 1 ) );
+        }
+
+        return value;
+    }
+
+    /**
+     * Get all of the connections that this provider has created readers or
+     * writers for, and that have not been closed yet.
+     *
+     * @return A snapshot of the open connections
+     */
+    public List<NativeConnection> getConnections(){
+        synchronized( m_connections ){
+            return new ArrayList<NativeConnection>( m_connections.values() );
+        }
+    }
+
+    /**
+     * Get all of the NativeSocketProviders that have been created, e.g. by
+     * dbus-java when it connects to a bus.
+     *
+     * @return The providers that are still in use
+     */
+    public static List<NativeSocketProvider> getInstances(){
+        synchronized( s_instances ){
+            return new ArrayList<NativeSocketProvider>( s_instances );
+        }
+    }
+
+    /**
+     * Sample the socket queues and stall times of all open connections.
+     *
+     * @return The gauges of each open connection
+     */
+    public List<QueueGauges> sampleQueues(){
+        List<QueueGauges> gauges = new ArrayList<QueueGauges>();
+
+        for( NativeConnection connection : getConnections() ){
+            NativeMessageReader reader = connection.getReader();
+            NativeMessageWriter writer = connection.getWriter();
+            long[] readerSample = reader == null ? null : reader.sample();
+            long[] writerSample = writer == null ? null : writer.sample();
+
+            if( readerSample != null || writerSample != null ){
+                gauges.add( new QueueGauges( connection, readerSample, writerSample ) );
+            }
+        }
+
+        return gauges;
+    }
+
+    /**
+     * Start sampling the connections of this provider in the background,
+     * calling the listener when a connection falls behind.
+     *
+     * @param periodMillis How often to sample, in milliseconds
+     * @param queueBytesThreshold The number of queued bytes in either direction
+     * that counts as stalled, or 0 to not check the queue size
+     * @param stallMillisThreshold How long the reader or writer may go without progress, in milliseconds,
+     * or 0 to not check for stalled readers and writers
+     * @param listener The listener to call, or null
+     * @return The monitor, which must be closed to stop sampling
+     * @see NativeQueueMonitor
+     */
+    public NativeQueueMonitor startQueueMonitor( long periodMillis, long queueBytesThreshold,
+            long stallMillisThreshold, QueueStallListener listener ){
+        NativeQueueMonitor monitor = new NativeQueueMonitor( this, periodMillis, TimeUnit.MILLISECONDS,
+                queueBytesThreshold, stallMillisThreshold, TimeUnit.MILLISECONDS );
+        if( listener != null ){
+            monitor.addListener( listener );
+        }
+        return monitor;
+    }
+
+    /**
+     * Get the connection that a new reader or writer for the given socket
+     * belongs to.  dbus-java creates the reader and the writer of a socket
+     * separately, so the second one joins the connection the first one made.
+     */
+    private NativeConnection getConnection( int fd, boolean forReader ){
+        synchronized( m_connections ){
+            NativeConnection connection = m_connections.get( fd );
+            if( connection == null
+                    || connection.isClosed()
+                    || ( forReader ? connection.getReader() != null : connection.getWriter() != null ) ){
+                connection = new NativeConnection( fd );
+                m_connections.put( fd, connection );
+            }
+            return connection;
+        }
+    }
+
+    private static boolean isValidCaptureSize( long captureSize ){
+        return captureSize > 0 && captureSize <= MAX_CAPTURE_SIZE;
+    }
+
+    /**
+     * Forget about a connection that we failed to create a reader or writer for,
+     * unless the other half of it was created successfully.
+     */
+    private void abandonConnection( NativeConnection connection ){
+        synchronized( m_connections ){
+            if( connection.getReader() == null && connection.getWriter() == null ){
+                m_connections.remove( connection.getFileDescriptor(), connection );
+            }
+        }
+    }
+
+    private void connectionClosed( NativeConnection connection ){
+        if( !connection.isClosed() ){
+            return;
+        }
+
+        // The socket itself belongs to the channel that dbus-java gave us,
+        // which closes it after closing the reader and the writer
+        synchronized( m_connections ){
+            m_connections.remove( connection.getFileDescriptor(), connection );
+        }
+    }
+
+    /**
+     * Get the capture file to use for the given connection.  The reader and the
+     * writer of the connection both ask for it, and get the same file.
+     */
+    private String getCapturePath( NativeConnection connection ){
+        synchronized( connection ){
+            String path = connection.getCapturePath();
+            if( path == null ){
+                path = new File( m_captureDirectory,
+                        String.format( "dbus-%d-%d.cap", ProcessHandle.current().pid(), s_captureCounter.incrementAndGet() ) )
+                        .getAbsolutePath();
+                connection.setCapturePath( path );
+                logger.debug( "Capturing {} to {}", connection, path );
+            }
+            return path;
+        }
+    }
+
+    /**
+     * Make sure that the native library has been loaded, for code that uses
+     * the readers and writers without going through a DBusConnection.
+     */
+    static void ensureNativeLibraryLoaded(){
+        // Loading happens in our static initializer
+    }
+
     /**
      * Load the native library.
      *
-     * There are two important system properties that can be set here:
+     * There are three important system properties that can be set here:
      *
      * com.rm5248.dbusnative.lib.path - give the directory name that the JNI
      * code is located in
@@ -85,6 +436,14 @@ public class NativeSocketProvider implements org.freedesktop.dbus.spi.message.IS
      * com.rm5248.dbusnative.lib.name - explicitly give the
      * name of the library(the default is 'dbus-java-jni-connector')
      *
+     * com.rm5248.dbusnative.cache.path - the directory that the library is
+     * extracted to(the default is 'dbus-java-nativefd-USER' in java.io.tmpdir)
+     *
+     * The library is extracted into a subdirectory of the cache path named after
+     * a hash of its contents, so that later JVMs can load it without extracting
+     * it again.  If the CPU supports it, an optimized build of the library is
+     * preferred over the generic one.
+     *
      * This is based largely off of SQLite-JDBC
      * ( https://github.com/xerial/sqlite-jdbc )
      */
@@ -111,31 +470,220 @@ public class NativeSocketProvider implements org.freedesktop.dbus.spi.message.IS
         }
 
         //if we get here, that means that we must extract the JNI from the jar
+        String osName;
+        String arch;
+        byte[] library = null;
+        String fileToExtract = null;
+
+        osName = System.getProperty( "os.name" );
+        if( osName.contains( "Windows" ) ){
+            osName = "Windows";
+        } else if( osName.contains( "Mac" ) || osName.contains( "Darwin" ) ){
+            osName = "Mac";
+        } else if( osName.contains( "Linux" ) ){
+            osName = "Linux";
+        } else{
+            osName = osName.replaceAll( "\\W", "" );
+        }
+
+        arch = System.getProperty( "os.arch" ).replaceAll( "\\W", "" );
+
+        if( arch.equals( "x86_64" ) ){
+            //map x86_64 to amd64 to stay consistent(needed for mac)
+            arch = "amd64";
+        } else if( arch.equals( "x86" ) || arch.equals( "i686" ) ){
+            arch = "i386";
+        } else if( arch.equals( "arm64" ) ){
+            arch = "aarch64";
+        } else if( arch.equals( "arm" ) ){
+            arch = "armhf";
+        }
+
         try{
-            File extractedLib;
-            Path tempFolder;
-            String osName;
-            String arch;
-            InputStream library;
+            for( String variant : getArchitectureVariants( osName, arch ) ){
+                fileToExtract = "/" + osName + "/" + variant + "/" + nativeLibraryName;
+                logger.debug( "Looking for {} in JAR", fileToExtract );
+                try( InputStream is = NativeSocketProvider.class.getResourceAsStream( fileToExtract ) ){
+                    if( is != null ){
+                        library = is.readAllBytes();
+                        break;
+                    }
+                }
+            }
+        } catch( IOException e ){
+            throw new UnsatisfiedLinkError( "Unable to read native library from JAR: " + e.getMessage() );
+        }
+
+        if( library == null ){
+            throw new UnsatisfiedLinkError( "Unable to extract native library from JAR:"
+                    + fileToExtract + "."
+            );
+        }
+
+        File extractedLib;
+        try{
+            extractedLib = extractToCache( library, nativeLibraryName );
+        } catch( IOException e ){
+            logger.debug( "Unable to use native library cache, extracting to temp folder", e );
+            extractedLib = extractToTempFolder( library, nativeLibraryName );
+        }
 
-            osName = System.getProperty( "os.name" );
-            if( osName.contains( "Windows" ) ){
-                osName = "Windows";
-            } else if( osName.contains( "Mac" ) || osName.contains( "Darwin" ) ){
-                osName = "Mac";
-            } else if( osName.contains( "Linux" ) ){
-                osName = "Linux";
-            } else{
-                osName = osName.replaceAll( "\\W", "" );
+        System.load( extractedLib.getAbsolutePath() );
+    }
+
+    /**
+     * Get the directories to look for the native library in, best first.
+     *
+     * @param osName The normalized name of the OS
+     * @param arch The normalized name of the architecture
+     * @return The list of architecture directories to try, in order
+     */
+    private static List<String> getArchitectureVariants( String osName, String arch ){
+        List<String> variants = new ArrayList<String>();
+
+        if( osName.equals( "Linux" ) && arch.equals( "amd64" ) ){
+            Set<String> flags = getCpuFlags();
+            if( flags.containsAll( X86_64_V3_FLAGS ) ){
+                variants.add( "amd64-v3" );
             }
+        }
+
+        variants.add( arch );
+        logger.debug( "Native library architecture variants: {}", variants );
 
-            arch = System.getProperty( "os.arch" );
-            arch.replaceAll( "\\W", "" );
+        return variants;
+    }
 
-            if( arch.equals( "x86_64" ) ){
-                //map x86_64 to amd64 to stay consistent(needed for mac)
-                arch = "amd64";
+    /**
+     * Read the x86 CPU feature flags from /proc/cpuinfo.
+     *
+     * @return The flags of the first CPU, or an empty set if they could not be read
+     */
+    private static Set<String> getCpuFlags(){
+        try( BufferedReader reader = Files.newBufferedReader( Paths.get( "/proc/cpuinfo" ) ) ){
+            String line;
+            while( (line = reader.readLine()) != null ){
+                int colon = line.indexOf( ':' );
+                if( colon < 0 || !line.substring( 0, colon ).trim().equals( "flags" ) ){
+                    continue;
+                }
+
+                return new HashSet<String>( Arrays.asList( line.substring( colon + 1 ).trim().split( "\\s+" ) ) );
+            }
+        } catch( IOException e ){
+            logger.debug( "Unable to read CPU flags", e );
+        }
+
+        return Collections.emptySet();
+    }
+
+    /**
+     * Extract the library into the cache directory, or re-use an
+     * already extracted copy with the same contents.
+     *
+     * Each library is stored in a folder named after the hash of its contents,
+     * and is written to a temporary file first and then atomically renamed, so
+     * that concurrent JVMs never see a partially written library.
+     *
+     * @param library The contents of the library
+     * @param nativeLibraryName The file name of the library
+     * @return The extracted library
+     * @throws IOException If the cache can't be used
+     */
+    private static File extractToCache( byte[] library, String nativeLibraryName ) throws IOException {
+        String cachePath = System.getProperty( "com.rm5248.dbusnative.cache.path" );
+        Path cacheFolder;
+        Path libFolder;
+        Path extractedLib;
+        String hash = hashLibrary( library );
+
+        if( cachePath == null ){
+            cacheFolder = Paths.get( System.getProperty( "java.io.tmpdir" ),
+                    "dbus-java-nativefd-" + System.getProperty( "user.name" ).replaceAll( "\\W", "" ) );
+        } else{
+            cacheFolder = Paths.get( cachePath );
+        }
+
+        libFolder = cacheFolder.resolve( hash );
+        createPrivateDirectory( cacheFolder );
+        createPrivateDirectory( libFolder );
+
+        extractedLib = libFolder.resolve( nativeLibraryName );
+        if( Files.isRegularFile( extractedLib, LinkOption.NOFOLLOW_LINKS )
+                && Files.size( extractedLib ) == library.length
+                && hash.equals( hashLibrary( Files.readAllBytes( extractedLib ) ) ) ){
+            logger.debug( "Using cached native library {}", extractedLib );
+            return extractedLib.toFile();
+        }
+
+        Path tempLib = Files.createTempFile( libFolder, nativeLibraryName, ".tmp" );
+        try{
+            Files.write( tempLib, library );
+            Files.move( tempLib, extractedLib, StandardCopyOption.ATOMIC_MOVE, StandardCopyOption.REPLACE_EXISTING );
+        } finally{
+            Files.deleteIfExists( tempLib );
+        }
+
+        logger.debug( "Extracted native library to {}", extractedLib );
+
+        return extractedLib.toFile();
+    }
+
+    /**
+     * Create the given directory if it does not exist, making sure that only
+     * the current user is able to write to it.
+     */
+    private static void createPrivateDirectory( Path directory ) throws IOException {
+        boolean isPosix = directory.getFileSystem().supportedFileAttributeViews().contains( "posix" );
+
+        if( !Files.exists( directory, LinkOption.NOFOLLOW_LINKS ) ){
+            try{
+                if( isPosix ){
+                    Files.createDirectory( directory,
+                            PosixFilePermissions.asFileAttribute( PosixFilePermissions.fromString( "rwx------" ) ) );
+                } else{
+                    Files.createDirectory( directory );
+                }
+            } catch( FileAlreadyExistsException e ){
+                // Another JVM created it at the same time; checked below
             }
+        }
+
+        if( !Files.isDirectory( directory, LinkOption.NOFOLLOW_LINKS ) ){
+            throw new IOException( directory + " is not a directory" );
+        }
+
+        if( isPosix ){
+            Set<PosixFilePermission> perms = Files.getPosixFilePermissions( directory, LinkOption.NOFOLLOW_LINKS );
+            if( !Files.getOwner( directory, LinkOption.NOFOLLOW_LINKS ).getName().equals( System.getProperty( "user.name" ) )
+                    || perms.contains( PosixFilePermission.GROUP_WRITE )
+                    || perms.contains( PosixFilePermission.OTHERS_WRITE ) ){
+                throw new IOException( directory + " is not private to the current user" );
+            }
+        }
+    }
+
+    private static String hashLibrary( byte[] library ) throws IOException {
+        StringBuilder hash = new StringBuilder();
+
+        try{
+            for( byte b : MessageDigest.getInstance( "SHA-256" ).digest( library ) ){
+                hash.append( String.format( "%02x", b ) );
+            }
+        } catch( NoSuchAlgorithmException e ){
+            throw new IOException( e );
+        }
+
+        return hash.toString();
+    }
+
+    /**
+     * Extract the library to a new temporary folder that is deleted on exit.
+     */
+    private static File extractToTempFolder( byte[] library, String nativeLibraryName ){
+        try{
+            File extractedLib;
+            Path tempFolder;
 
             //create the temp folder to extract the library to
             tempFolder = Files.createTempDirectory( "dbus-java" );
@@ -144,22 +692,10 @@ public class NativeSocketProvider implements org.freedesktop.dbus.spi.message.IS
             logger.debug( "Created temp folder of {}", tempFolder );
 
             extractedLib = new File( tempFolder.toFile(), nativeLibraryName );
-
-            String fileToExtract = "/" + osName + "/" + arch + "/" + nativeLibraryName;
-            logger.debug( "About to extract {} from JAR", fileToExtract );
-            //now let's extract the proper library
-            library = NativeSocketProvider.class.getResourceAsStream( fileToExtract );
-
-            if( library == null ){
-                throw new UnsatisfiedLinkError( "Unable to extract native library from JAR:"
-                        + fileToExtract + "."
-                );
-            }
-
-            Files.copy( library, extractedLib.toPath() );
+            Files.write( extractedLib.toPath(), library );
             extractedLib.deleteOnExit();
 
-            System.load( extractedLib.getAbsolutePath() );
+            return extractedLib;
         } catch( IOException e ){
             throw new UnsatisfiedLinkError( "Unable to create temp directory or extract: " + e.getMessage() );
         }
@@ -0,0 +1,64 @@
+package com.rm5248.dbusjava.nativefd;
+
+/**
+ * A sample of how far behind a connection is.
+ */
+public class QueueGauges {
+
+    private final NativeConnection m_connection;
+    private final long m_receiveQueueBytes;
+    private final long m_sendQueueBytes;
+    private final long m_readerIdleNanos;
+    private final long m_writerBlockedNanos;
+
+    QueueGauges( NativeConnection connection, long[] readerSample, long[] writerSample ){
+        m_connection = connection;
+        m_receiveQueueBytes = readerSample == null ? -1 : readerSample[ 0 ];
+        m_readerIdleNanos = readerSample == null ? 0 : readerSample[ 1 ];
+        m_sendQueueBytes = writerSample == null ? -1 : writerSample[ 0 ];
+        m_writerBlockedNanos = writerSample == null ? 0 : writerSample[ 1 ];
+    }
+
+    public NativeConnection getConnection(){
+        return m_connection;
+    }
+
+    /**
+     * @return The number of bytes received by the kernel that have not been read yet(SIOCINQ), or -1 if unknown
+     */
+    public long getReceiveQueueBytes(){
+        return m_receiveQueueBytes;
+    }
+
+    /**
+     * @return The number of bytes written that have not been sent yet(SIOCOUTQ), or -1 if unknown
+     */
+    public long getSendQueueBytes(){
+        return m_sendQueueBytes;
+    }
+
+    /**
+     * @return How long it has been since the reader returned the last message
+     * while nobody has asked it for the next one, or 0 if it is currently waiting for one
+     */
+    public long getReaderIdleNanos(){
+        return m_readerIdleNanos;
+    }
+
+    /**
+     * @return How long the writer has been blocked sending the current
+     * message, or 0 if it is not sending
+     */
+    public long getWriterBlockedNanos(){
+        return m_writerBlockedNanos;
+    }
+
+    @Override
+    public String toString(){
+        return "QueueGauges[" + m_connection
+                + ", receiveQueueBytes=" + m_receiveQueueBytes
+                + ", sendQueueBytes=" + m_sendQueueBytes
+                + ", readerIdleNanos=" + m_readerIdleNanos
+                + ", writerBlockedNanos=" + m_writerBlockedNanos + "]";
+    }
+}
@@ -0,0 +1,23 @@
+package com.rm5248.dbusjava.nativefd;
+
+/**
+ * Called by a NativeQueueMonitor when a connection falls behind.
+ */
+public interface QueueStallListener {
+
+    /**
+     * A connection has gone over one of the thresholds of the monitor.  This
+     * is called once, until the connection has recovered.
+     *
+     * @param gauges The sample that went over the threshold
+     */
+    void queueStalled( QueueGauges gauges );
+
+    /**
+     * A connection that was stalled is back under all of the thresholds.
+     *
+     * @param gauges The sample that was under the thresholds
+     */
+    default void queueRecovered( QueueGauges gauges ){
+    }
+}
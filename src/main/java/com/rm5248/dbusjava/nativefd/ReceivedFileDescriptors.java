@@ -0,0 +1,103 @@
+package com.rm5248.dbusjava.nativefd;
+
+import java.util.AbstractList;
+import java.util.Arrays;
+import java.util.RandomAccess;
+
+import org.freedesktop.dbus.FileDescriptor;
+
+/**
+ * The file descriptors that came with a received message.
+ *
+ * The numbers are kept in the int[] that the native code created, and the
+ * FileDescriptor for a number is only created the first time that it is
+ * asked for.  Most messages carry no file descriptors, and dbus-java only
+ * looks at the ones that the message body refers to, so this avoids creating
+ * a wrapper for every descriptor of every message.  The list can still be
+ * changed like any other list.
+ */
+class ReceivedFileDescriptors extends AbstractList<FileDescriptor> implements RandomAccess {
+
+    private static final int[] NO_FDS = new int[ 0 ];
+
+    private int[] m_fds;
+    private FileDescriptor[] m_wrappers;
+    private int m_size;
+
+    /**
+     * @param fds The file descriptors, or null if there are none.  The array
+     * is used directly, not copied.
+     */
+    ReceivedFileDescriptors( int[] fds ){
+        m_fds = fds == null ? NO_FDS : fds;
+        m_size = m_fds.length;
+    }
+
+    @Override
+    public FileDescriptor get( int index ){
+        checkIndex( index, m_size );
+
+        if( m_wrappers == null ){
+            m_wrappers = new FileDescriptor[ m_fds.length ];
+        }
+        if( m_wrappers[ index ] == null ){
+            m_wrappers[ index ] = new FileDescriptor( m_fds[ index ] );
+        }
+
+        return m_wrappers[ index ];
+    }
+
+    @Override
+    public int size(){
+        return m_size;
+    }
+
+    @Override
+    public FileDescriptor set( int index, FileDescriptor fd ){
+        FileDescriptor old = get( index );
+
+        m_fds[ index ] = fd.getIntFileDescriptor();
+        m_wrappers[ index ] = fd;
+
+        return old;
+    }
+
+    @Override
+    public void add( int index, FileDescriptor fd ){
+        checkIndex( index, m_size + 1 );
+
+        if( m_size == m_fds.length ){
+            int capacity = Math.max( 4, m_size * 2 );
+            m_fds = Arrays.copyOf( m_fds, capacity );
+            m_wrappers = m_wrappers == null ? new FileDescriptor[ capacity ] : Arrays.copyOf( m_wrappers, capacity );
+        }else if( m_wrappers == null ){
+            m_wrappers = new FileDescriptor[ m_fds.length ];
+        }
+
+        System.arraycopy( m_fds, index, m_fds, index + 1, m_size - index );
+        System.arraycopy( m_wrappers, index, m_wrappers, index + 1, m_size - index );
+        m_fds[ index ] = fd.getIntFileDescriptor();
+        m_wrappers[ index ] = fd;
+        m_size++;
+        modCount++;
+    }
+
+    @Override
+    public FileDescriptor remove( int index ){
+        FileDescriptor old = get( index );
+
+        System.arraycopy( m_fds, index + 1, m_fds, index, m_size - index - 1 );
+        System.arraycopy( m_wrappers, index + 1, m_wrappers, index, m_size - index - 1 );
+        m_size--;
+        m_wrappers[ m_size ] = null;
+        modCount++;
+
+        return old;
+    }
+
+    private static void checkIndex( int index, int size ){
+        if( index < 0 || index >= size ){
+            throw new IndexOutOfBoundsException( "Index: " + index + ", Size: " + size );
+        }
+    }
+}
@@ -0,0 +1,172 @@
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "native-affinity.h"
+
+/* From <numaif.h>, so that we don't need libnuma to build */
+#define AFFINITY_MPOL_PREFERRED 1
+
+/*
+ * Find the NUMA node that a CPU belongs to, by looking for the nodeN link in
+ * its sysfs directory.
+ *
+ * @return The node, or -1 if it can't be found
+ */
+static int cpu_to_node( int cpu ){
+	char path[ 64 ];
+	DIR* dir;
+	struct dirent* entry;
+	int node = -1;
+
+	snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%d", cpu );
+	dir = opendir( path );
+	if( dir == NULL ){
+		return -1;
+	}
+
+	while( ( entry = readdir( dir ) ) != NULL ){
+		if( sscanf( entry->d_name, "node%d", &node ) == 1 ){
+			break;
+		}
+		node = -1;
+	}
+
+	closedir( dir );
+
+	return node;
+}
+
+void affinity_init( JNIEnv* env, jintArray cpus, jboolean numa_local, struct AffinitySettings* settings ){
+	int num_cpus = 0;
+	int first_cpu = -1;
+	jint* cpu_list;
+	int x;
+
+	memset( settings, 0, sizeof( struct AffinitySettings ) );
+	CPU_ZERO( &settings->cpus );
+	settings->numa_local = numa_local;
+	settings->node = -1;
+
+	if( cpus != NULL ){
+		num_cpus = (*env)->GetArrayLength( env, cpus );
+	}
+
+	if( num_cpus == 0 ){
+		return;
+	}
+
+	cpu_list = malloc( sizeof( jint ) * num_cpus );
+	(*env)->GetIntArrayRegion( env, cpus, 0, num_cpus, cpu_list );
+
+	for( x = 0; x < num_cpus; x++ ){
+		if( cpu_list[ x ] < 0 || cpu_list[ x ] >= CPU_SETSIZE ){
+			continue;
+		}
+
+		CPU_SET( cpu_list[ x ], &settings->cpus );
+		if( first_cpu < 0 ){
+			first_cpu = cpu_list[ x ];
+		}
+		settings->pinned = 1;
+	}
+
+	free( cpu_list );
+
+	if( first_cpu >= 0 ){
+		settings->node = cpu_to_node( first_cpu );
+	}
+}
+
+int affinity_apply( struct AffinitySettings* settings ){
+	pthread_t self = pthread_self();
+
+	if( !settings->pinned ){
+		return 0;
+	}
+
+	if( settings->has_pinned_thread && pthread_equal( settings->pinned_thread, self ) ){
+		return 0;
+	}
+
+	if( pthread_setaffinity_np( self, sizeof( cpu_set_t ), &settings->cpus ) != 0 ){
+		return 0;
+	}
+
+	settings->pinned_thread = self;
+	settings->has_pinned_thread = 1;
+
+	return 1;
+}
+
+/*
+ * Every buffer starts with this header, so that affinity_free() knows how the
+ * buffer was allocated even if the settings have changed since then.
+ */
+struct AffinityBuffer {
+	/* The length of the mapping, or 0 if the buffer came from malloc() */
+	size_t map_len;
+	/* Keep the data after the header as aligned as malloc() would */
+	size_t padding;
+};
+
+void* affinity_alloc( struct AffinitySettings* settings, size_t size ){
+	long page_size;
+	size_t map_len;
+	struct AffinityBuffer* buffer;
+
+	if( !settings->numa_local || settings->node < 0 ){
+		buffer = malloc( sizeof( struct AffinityBuffer ) + size );
+		if( buffer == NULL ){
+			return NULL;
+		}
+		buffer->map_len = 0;
+		return buffer + 1;
+	}
+
+	/* Map whole pages of our own, so that the node policy only applies to
+	 * this buffer and goes away with it, instead of sticking to heap pages
+	 * that malloc() hands out again later */
+	page_size = sysconf( _SC_PAGESIZE );
+	map_len = ( sizeof( struct AffinityBuffer ) + size + page_size - 1 ) & ~( (size_t)page_size - 1 );
+	buffer = mmap( NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if( buffer == MAP_FAILED ){
+		return NULL;
+	}
+
+#ifdef SYS_mbind
+	if( settings->node < (int)( sizeof( unsigned long ) * 8 ) ){
+		unsigned long nodemask = 1UL << settings->node;
+
+		/* Only a preference, so that we still get memory if the node is full */
+		syscall( SYS_mbind, buffer, map_len, AFFINITY_MPOL_PREFERRED,
+			&nodemask, sizeof( nodemask ) * 8 + 1, 0 );
+	}
+#endif
+
+	/* Fault the pages in now, instead of on the first message */
+	memset( buffer, 0, map_len );
+	buffer->map_len = map_len;
+
+	return buffer + 1;
+}
+
+void affinity_free( void* data ){
+	struct AffinityBuffer* buffer;
+
+	if( data == NULL ){
+		return;
+	}
+
+	buffer = (struct AffinityBuffer*)data - 1;
+	if( buffer->map_len == 0 ){
+		free( buffer );
+	}else{
+		munmap( buffer, buffer->map_len );
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef NATIVE_AFFINITY_H
+#define NATIVE_AFFINITY_H
+
+#include <sched.h>
+#include <pthread.h>
+#include <stddef.h>
+
+#include <jni.h>
+
+/**
+ * CPU affinity and memory placement for the native I/O path of a connection.
+ *
+ * When a connection is pinned, the thread that reads from it is moved onto
+ * the given CPUs the first time that it calls into the reader.  dbus-java
+ * reads each connection from a dedicated thread, so this never pins an
+ * application thread; threads that send messages are left alone.
+ *
+ * Buffers that should be NUMA-local are mapped with mmap, bound to the node
+ * of the first pinned CPU(with mbind) and touched before use, so they are
+ * placed on that node no matter which thread allocates them.
+ */
+struct AffinitySettings {
+	cpu_set_t cpus;
+	int pinned;
+	int numa_local;
+	/* The NUMA node of the first pinned CPU, or -1 if not known */
+	int node;
+	/* The thread that we last pinned */
+	pthread_t pinned_thread;
+	int has_pinned_thread;
+};
+
+/**
+ * Fill in the affinity settings from the given list of CPUs.
+ *
+ * @param env The JNI environment as passed by the JVM
+ * @param cpus The CPUs to pin to, or NULL/empty to not pin
+ * @param numa_local If buffers should be placed on the NUMA node of the CPUs
+ * @param settings The settings to fill in
+ */
+void affinity_init( JNIEnv* env, jintArray cpus, jboolean numa_local, struct AffinitySettings* settings );
+
+/**
+ * Pin the calling thread to the CPUs in the settings, if it has not been
+ * pinned already.  Only call this from a thread dedicated to the connection.
+ *
+ * @return 1 if the thread was pinned by this call, 0 otherwise
+ */
+int affinity_apply( struct AffinitySettings* settings );
+
+/**
+ * Allocate a buffer for the connection.  If the settings ask for NUMA-local
+ * buffers, the buffer is placed on the node of the pinned CPUs.  The buffer
+ * must be released with affinity_free().
+ *
+ * @param settings The settings of the connection
+ * @param size The number of bytes to allocate
+ * @return The buffer, or NULL if it could not be allocated
+ */
+void* affinity_alloc( struct AffinitySettings* settings, size_t size );
+
+/**
+ * Release a buffer from affinity_alloc().
+ *
+ * @param buffer The buffer, or NULL
+ */
+void affinity_free( void* buffer );
+
+#endif
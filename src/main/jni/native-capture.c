@@ -0,0 +1,169 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "native-capture.h"
+
+struct CaptureRing {
+	struct CaptureRing* next;
+	char* path;
+	int refcount;
+	size_t map_len;
+	struct capture_file_header* header;
+	uint8_t* data;
+};
+
+/* All of the open rings, so that the reader and writer of a connection share one */
+static struct CaptureRing* open_rings = NULL;
+static pthread_mutex_t open_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct CaptureRing* capture_open( const char* path, uint64_t capacity ){
+	struct CaptureRing* ring;
+	int fd;
+	void* map;
+
+	/* Round down to our record alignment */
+	capacity &= ~(uint64_t)7;
+	if( capacity < sizeof( struct capture_record_header ) ){
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_mutex_lock( &open_rings_lock );
+
+	for( ring = open_rings; ring != NULL; ring = ring->next ){
+		if( strcmp( ring->path, path ) == 0 ){
+			ring->refcount++;
+			pthread_mutex_unlock( &open_rings_lock );
+			return ring;
+		}
+	}
+
+	fd = open( path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600 );
+	if( fd < 0 ){
+		pthread_mutex_unlock( &open_rings_lock );
+		return NULL;
+	}
+
+	if( ftruncate( fd, CAPTURE_HEADER_SIZE + capacity ) < 0 ){
+		int saved_errno = errno;
+		close( fd );
+		pthread_mutex_unlock( &open_rings_lock );
+		errno = saved_errno;
+		return NULL;
+	}
+
+	map = mmap( NULL, CAPTURE_HEADER_SIZE + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( map == MAP_FAILED ){
+		pthread_mutex_unlock( &open_rings_lock );
+		return NULL;
+	}
+
+	ring = calloc( 1, sizeof( struct CaptureRing ) );
+	ring->path = strdup( path );
+	ring->refcount = 1;
+	ring->map_len = CAPTURE_HEADER_SIZE + capacity;
+	ring->header = map;
+	ring->data = (uint8_t*)map + CAPTURE_HEADER_SIZE;
+
+	ring->header->version = CAPTURE_VERSION;
+	ring->header->header_size = CAPTURE_HEADER_SIZE;
+	ring->header->capacity = capacity;
+	/* Write the magic last, so that a reader never sees a half-initialized header */
+	memcpy( ring->header->magic, CAPTURE_FILE_MAGIC, sizeof( ring->header->magic ) );
+
+	ring->next = open_rings;
+	open_rings = ring;
+
+	pthread_mutex_unlock( &open_rings_lock );
+
+	return ring;
+}
+
+void capture_close( struct CaptureRing* ring ){
+	struct CaptureRing** pos;
+
+	if( ring == NULL ){
+		return;
+	}
+
+	pthread_mutex_lock( &open_rings_lock );
+
+	if( --ring->refcount > 0 ){
+		pthread_mutex_unlock( &open_rings_lock );
+		return;
+	}
+
+	for( pos = &open_rings; *pos != NULL; pos = &(*pos)->next ){
+		if( *pos == ring ){
+			*pos = ring->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock( &open_rings_lock );
+
+	munmap( ring->header, ring->map_len );
+	free( ring->path );
+	free( ring );
+}
+
+void capture_record( struct CaptureRing* ring, int direction, const void* data, size_t data_len, int num_fds ){
+	struct capture_file_header* header = ring->header;
+	struct capture_record_header* record;
+	uint64_t capacity = header->capacity;
+	uint64_t record_len = ( sizeof( struct capture_record_header ) + data_len + 7 ) & ~(uint64_t)7;
+	uint64_t head;
+	uint64_t pos;
+	uint64_t reserve_len;
+	struct timespec now;
+
+	if( record_len > capacity ){
+		__atomic_fetch_add( &header->dropped, 1, __ATOMIC_RELAXED );
+		return;
+	}
+
+	/* Reserve our space in the ring.  If the record does not fit before the
+	 * end of the ring, we also reserve the remainder of the ring as padding */
+	head = __atomic_load_n( &header->head, __ATOMIC_RELAXED );
+	do{
+		pos = head % capacity;
+		reserve_len = record_len;
+		if( pos + record_len > capacity ){
+			reserve_len += capacity - pos;
+		}
+	}while( !__atomic_compare_exchange_n( &header->head, &head, head + reserve_len,
+			1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) );
+
+	if( reserve_len != record_len ){
+		/* Only the magic and length of a padding record are meaningful,
+		 * and those always fit as everything is 8-byte aligned */
+		record = (struct capture_record_header*)( ring->data + pos );
+		record->record_len = capacity - pos;
+		__atomic_store_n( &record->magic, CAPTURE_PAD_MAGIC, __ATOMIC_RELEASE );
+		pos = 0;
+	}
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	record = (struct capture_record_header*)( ring->data + pos );
+	__atomic_store_n( &record->magic, 0, __ATOMIC_RELAXED );
+	record->record_len = record_len;
+	record->sequence = __atomic_fetch_add( &header->sequence, 1, __ATOMIC_RELAXED );
+	record->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+	record->data_len = data_len;
+	record->direction = direction;
+	record->num_fds = num_fds;
+	memcpy( record + 1, data, data_len );
+
+	/* Publish the record */
+	__atomic_store_n( &record->magic, CAPTURE_RECORD_MAGIC, __ATOMIC_RELEASE );
+}
@@ -0,0 +1,88 @@
+#ifndef NATIVE_CAPTURE_H
+#define NATIVE_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Capturing of the raw bytes that go over a connection.
+ *
+ * A capture file is a memory-mapped ring that the reader and writer of a
+ * connection both append to.  Appending a message is lock-free and does not
+ * call back into the JVM.  The layout of the file(all values in native byte order):
+ *
+ * struct capture_file_header  - at offset 0
+ * data area                   - CAPTURE_HEADER_SIZE bytes in, capacity bytes long
+ *
+ * The data area holds records that are each aligned to 8 bytes, starting
+ * with a struct capture_record_header followed by the message bytes.  A record
+ * never wraps around the end of the data area; if it does not fit, a padding
+ * record(CAPTURE_PAD_MAGIC) fills the rest of the ring and the record is
+ * written at the start instead.
+ */
+
+#define CAPTURE_FILE_MAGIC "DBJCAP01"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 64
+
+#define CAPTURE_RECORD_MAGIC 0x52504143u
+#define CAPTURE_PAD_MAGIC 0x44415043u
+
+#define CAPTURE_DIRECTION_RX 0
+#define CAPTURE_DIRECTION_TX 1
+
+struct capture_file_header {
+	char magic[ 8 ];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t capacity;
+	/* Total number of bytes ever reserved in the data area */
+	uint64_t head;
+	/* Sequence number of the next record */
+	uint64_t sequence;
+	/* Records dropped because they were larger than the ring */
+	uint64_t dropped;
+};
+
+struct capture_record_header {
+	uint32_t magic;
+	/* Length of the record including this header and padding */
+	uint32_t record_len;
+	uint64_t sequence;
+	/* CLOCK_MONOTONIC time in nanoseconds */
+	uint64_t timestamp_ns;
+	uint32_t data_len;
+	uint16_t direction;
+	uint16_t num_fds;
+};
+
+struct CaptureRing;
+
+/**
+ * Open(or create) the capture ring at the given path.  If the ring is already
+ * open in this process, the existing mapping is shared.
+ *
+ * @param path The file to capture to
+ * @param capacity The size of the data area in bytes
+ * @return The ring, or NULL with errno set on failure
+ */
+struct CaptureRing* capture_open( const char* path, uint64_t capacity );
+
+/**
+ * Release a ring returned from capture_open.  The file is unmapped once the
+ * last user closes it.
+ */
+void capture_close( struct CaptureRing* ring );
+
+/**
+ * Append a message to the ring.
+ *
+ * @param ring The ring to append to
+ * @param direction CAPTURE_DIRECTION_RX or CAPTURE_DIRECTION_TX
+ * @param data The raw bytes of the message
+ * @param data_len The number of bytes in data
+ * @param num_fds The number of file descriptors that went with the message
+ */
+void capture_record( struct CaptureRing* ring, int direction, const void* data, size_t data_len, int num_fds );
+
+#endif
@@ -0,0 +1,127 @@
+#include <stdlib.h>
+
+#include "native-handles.h"
+
+#define HANDLE_GENERATION_MASK ( ( 1u << ( 31 - HANDLE_SLOT_BITS ) ) - 1 )
+
+static struct HandleSlot* get_slot( struct HandleTable* table, jint handle ){
+	struct HandleSlot* chunk;
+	int slot = handle & ( ( 1 << HANDLE_SLOT_BITS ) - 1 );
+
+	if( handle < 0 || slot >= HANDLE_CHUNK_SIZE * HANDLE_MAX_CHUNKS ){
+		return NULL;
+	}
+
+	chunk = __atomic_load_n( &table->chunks[ slot / HANDLE_CHUNK_SIZE ], __ATOMIC_ACQUIRE );
+	if( chunk == NULL ){
+		return NULL;
+	}
+
+	return &chunk[ slot % HANDLE_CHUNK_SIZE ];
+}
+
+static unsigned int get_generation( jint handle ){
+	return (unsigned int)handle >> HANDLE_SLOT_BITS;
+}
+
+jint handle_table_add( struct HandleTable* table, void* data ){
+	int chunk_pos;
+	int list_pos;
+	jint handle = -1;
+
+	pthread_mutex_lock( &table->lock );
+
+	for( chunk_pos = 0; chunk_pos < HANDLE_MAX_CHUNKS && handle < 0; chunk_pos++ ){
+		struct HandleSlot* chunk = table->chunks[ chunk_pos ];
+
+		if( chunk == NULL ){
+			chunk = calloc( HANDLE_CHUNK_SIZE, sizeof( struct HandleSlot ) );
+			if( chunk == NULL ){
+				break;
+			}
+			__atomic_store_n( &table->chunks[ chunk_pos ], chunk, __ATOMIC_RELEASE );
+		}
+
+		for( list_pos = 0; list_pos < HANDLE_CHUNK_SIZE; list_pos++ ){
+			struct HandleSlot* slot = &chunk[ list_pos ];
+
+			/* A slot that is still being closed may have users left */
+			if( slot->data == NULL && !slot->closing ){
+				handle = (jint)( ( slot->generation & HANDLE_GENERATION_MASK ) << HANDLE_SLOT_BITS )
+					| ( chunk_pos * HANDLE_CHUNK_SIZE + list_pos );
+				__atomic_store_n( &slot->data, data, __ATOMIC_SEQ_CST );
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock( &table->lock );
+
+	return handle;
+}
+
+void* handle_table_acquire( struct HandleTable* table, jint handle ){
+	struct HandleSlot* slot = get_slot( table, handle );
+	void* data;
+
+	if( slot == NULL ){
+		return NULL;
+	}
+
+	/* Announce ourselves before looking at the slot, so that a close either
+	 * happens before we look, or waits for us */
+	__atomic_add_fetch( &slot->users, 1, __ATOMIC_SEQ_CST );
+	data = __atomic_load_n( &slot->data, __ATOMIC_SEQ_CST );
+	if( data == NULL
+			|| ( __atomic_load_n( &slot->generation, __ATOMIC_SEQ_CST ) & HANDLE_GENERATION_MASK ) != get_generation( handle ) ){
+		handle_table_release( table, handle );
+		return NULL;
+	}
+
+	return data;
+}
+
+void handle_table_release( struct HandleTable* table, jint handle ){
+	struct HandleSlot* slot = get_slot( table, handle );
+
+	if( __atomic_sub_fetch( &slot->users, 1, __ATOMIC_SEQ_CST ) == 0
+			&& __atomic_load_n( &slot->closing, __ATOMIC_SEQ_CST ) ){
+		/* Take the lock, so that the wakeup can't slip in between the
+		 * closer checking the users and going to sleep */
+		pthread_mutex_lock( &table->lock );
+		pthread_cond_broadcast( &table->idle );
+		pthread_mutex_unlock( &table->lock );
+	}
+}
+
+void* handle_table_remove( struct HandleTable* table, jint handle ){
+	struct HandleSlot* slot;
+	void* data = NULL;
+
+	pthread_mutex_lock( &table->lock );
+
+	slot = get_slot( table, handle );
+	if( slot != NULL
+			&& slot->data != NULL
+			&& ( slot->generation & HANDLE_GENERATION_MASK ) == get_generation( handle ) ){
+		data = slot->data;
+		__atomic_store_n( &slot->closing, 1, __ATOMIC_SEQ_CST );
+		__atomic_store_n( &slot->generation, slot->generation + 1, __ATOMIC_SEQ_CST );
+		__atomic_store_n( &slot->data, NULL, __ATOMIC_SEQ_CST );
+	}
+
+	pthread_mutex_unlock( &table->lock );
+
+	return data;
+}
+
+void handle_table_wait( struct HandleTable* table, jint handle ){
+	struct HandleSlot* slot = get_slot( table, handle );
+
+	pthread_mutex_lock( &table->lock );
+	while( __atomic_load_n( &slot->users, __ATOMIC_SEQ_CST ) > 0 ){
+		pthread_cond_wait( &table->idle, &table->lock );
+	}
+	__atomic_store_n( &slot->closing, 0, __ATOMIC_SEQ_CST );
+	pthread_mutex_unlock( &table->lock );
+}
@@ -0,0 +1,84 @@
+#ifndef NATIVE_HANDLES_H
+#define NATIVE_HANDLES_H
+
+#include <pthread.h>
+
+#include <jni.h>
+
+/**
+ * The table that maps the handles that Java holds on to the native data of
+ * readers and writers.
+ *
+ * The slots are stored in chunks that are allocated on demand and never moved
+ * or freed, so that a handle can be looked up without taking a lock.  Every
+ * call that uses a handle holds it with handle_table_acquire() until it is
+ * done, and closing a handle waits until nobody holds it any more before the
+ * caller frees the data.
+ *
+ * A handle is the slot number plus a generation that changes every time the
+ * slot is closed, so a handle of a closed connection never finds the data of
+ * a connection that re-used its slot.
+ */
+
+#define HANDLE_CHUNK_SIZE 64
+#define HANDLE_MAX_CHUNKS 1024
+
+/* The bits of a handle that hold the slot; the rest are the generation */
+#define HANDLE_SLOT_BITS 16
+
+struct HandleSlot {
+	void* data;
+	/* Changes every time the slot is closed */
+	unsigned int generation;
+	/* The number of calls that are currently using the slot */
+	int users;
+	/* Set from when the slot is closed until its users are gone */
+	int closing;
+};
+
+struct HandleTable {
+	struct HandleSlot* chunks[ HANDLE_MAX_CHUNKS ];
+	/* Serializes adding and removing handles; lookups don't take it */
+	pthread_mutex_t lock;
+	/* Signalled when the last user of a closing slot is gone */
+	pthread_cond_t idle;
+};
+
+#define HANDLE_TABLE_INITIALIZER { { NULL }, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
+
+/**
+ * Put data into a free slot of the table.
+ *
+ * @return The handle for the data, or -1 if all slots are in use
+ */
+jint handle_table_add( struct HandleTable* table, void* data );
+
+/**
+ * Look up a handle, and hold it so that it can't be freed until
+ * handle_table_release() is called.
+ *
+ * @return The data, or NULL if the handle has been closed
+ */
+void* handle_table_acquire( struct HandleTable* table, jint handle );
+
+/**
+ * Release a handle that handle_table_acquire() returned data for.
+ */
+void handle_table_release( struct HandleTable* table, jint handle );
+
+/**
+ * Close a handle, so that nothing can acquire it any more.  The caller must
+ * then wake up any blocked I/O on the data and call handle_table_wait() before
+ * freeing the data.
+ *
+ * @return The data, or NULL if the handle was already closed
+ */
+void* handle_table_remove( struct HandleTable* table, jint handle );
+
+/**
+ * Wait until all of the calls that were using a removed handle are done with
+ * it, and make its slot available again.
+ */
+void handle_table_wait( struct HandleTable* table, jint handle );
+
+#endif
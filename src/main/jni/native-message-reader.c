@@ -4,19 +4,33 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "com_rm5248_dbusjava_nativefd_NativeMessageReader.h"
 #include "jni_utils.h"
+#include "native-capture.h"
+#include "native-affinity.h"
+#include "native-monitor.h"
+#include "native-handles.h"
+
+/* The most file descriptors that the kernel will pass in one message(SCM_MAX_FD) */
+#define MAX_FDS_PER_MESSAGE 253
+
+/* Thrown when the other end closes the connection, like dbus-java's own readers do */
+#define JAVA_IO_EOFEXCEPTION "java/io/EOFException"
 
 struct ReceiveHandle {
 	struct msghdr msg_data;
 	int rx_iovlen;
 	int rx_controllen;
 	int fd;
+	struct CaptureRing* capture;
+	struct AffinitySettings affinity;
+	struct MonitorTimes monitor;
 };
 
-static struct ReceiveHandle** rx_array = NULL;
-static int rx_array_length = 0;
+static struct HandleTable rx_handles = HANDLE_TABLE_INITIALIZER;
 
 /*
  * Class:     com_rm5248_dbusjava_nativefd_NativeMessageReader
@@ -27,51 +41,32 @@ JNIEXPORT jint JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_ope
   (JNIEnv * env, jobject obj, jint fd){
 	struct ReceiveHandle* new_rx_handle;
 	int list_pos;
-	int found = 0;
-
-	/* First time - allocate 10 ReceiveHandles */
-	if( rx_array == NULL ){
-		rx_array = calloc( rx_array_length + 10, sizeof( struct ReceiveHandle* ) );
-		rx_array_length = 10;
-	}
-
-	/* Look for a free index into our array */
-	for( list_pos = 0; list_pos < rx_array_length; list_pos++ ){
-		if( rx_array[ list_pos] == NULL ){
-			found = 1;
-			break;
-		}
-	}
-
-	if( !found ){
-		/* No free slots - expand our array by 10 elements */
-		struct ReceiveHandle** new_rx_array = calloc( rx_array_length + 10, sizeof( struct ReceiveHandle* ) );
-
-		for( list_pos = 0; list_pos < rx_array_length; list_pos++ ){
-			new_rx_array[ list_pos ] = rx_array[ list_pos ];
-		}
-		list_pos += 1;
-		rx_array_length += 10;
-
-		free( rx_array );
-		rx_array = new_rx_array;
-	}
 
 	new_rx_handle = malloc( sizeof( struct ReceiveHandle ) );
 	memset( new_rx_handle, 0, sizeof( struct ReceiveHandle ) );
 
 	new_rx_handle->rx_iovlen = 1024;
-	new_rx_handle->rx_controllen = 512;
+	new_rx_handle->rx_controllen = CMSG_SPACE( sizeof( int ) * MAX_FDS_PER_MESSAGE );
 	new_rx_handle->fd = fd;
+	monitor_init( &new_rx_handle->monitor );
 
 	/* Allocate some place for data, as we need to peek at messages */
 	new_rx_handle->msg_data.msg_iov = malloc( sizeof( struct iovec ) );
-	new_rx_handle->msg_data.msg_iov[0].iov_base = malloc( new_rx_handle->rx_iovlen );
+	new_rx_handle->msg_data.msg_iov[0].iov_base = affinity_alloc( &new_rx_handle->affinity, new_rx_handle->rx_iovlen );
 	new_rx_handle->msg_data.msg_iov[0].iov_len = new_rx_handle->rx_iovlen;
 	new_rx_handle->msg_data.msg_iovlen = 1;
-	new_rx_handle->msg_data.msg_control = malloc( new_rx_handle->rx_controllen );
+	new_rx_handle->msg_data.msg_control = affinity_alloc( &new_rx_handle->affinity, new_rx_handle->rx_controllen );
+
+	list_pos = handle_table_add( &rx_handles, new_rx_handle );
 
-	rx_array[ list_pos ] = new_rx_handle;
+	if( list_pos < 0 ){
+		affinity_free( new_rx_handle->msg_data.msg_control );
+		affinity_free( new_rx_handle->msg_data.msg_iov[0].iov_base );
+		free( new_rx_handle->msg_data.msg_iov );
+		free( new_rx_handle );
+		jniutil_throw_ioexception( env, "Too many open connections" );
+		return -1;
+	}
 
 	return list_pos;
 }
@@ -83,35 +78,126 @@ JNIEXPORT jint JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_ope
  */
 JNIEXPORT void JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_closeNativeHandle
   (JNIEnv * env, jobject obj, jint handle){
-	struct ReceiveHandle* rx_handle = rx_array[ handle ];
+	struct ReceiveHandle* rx_handle = handle_table_remove( &rx_handles, handle );
+
+	if( rx_handle == NULL ){
+		return;
+	}
+
+	/* Wake up a reader that is blocked in recvmsg, and wait for it to be
+	 * done with our buffers.  Only the receiving side is shut down, as the
+	 * writer of the connection may still be sending. */
+	shutdown( rx_handle->fd, SHUT_RD );
+	handle_table_wait( &rx_handles, handle );
 
-	free( rx_handle->msg_data.msg_control );
-	free( rx_handle->msg_data.msg_iov[0].iov_base );
+	capture_close( rx_handle->capture );
+	affinity_free( rx_handle->msg_data.msg_control );
+	affinity_free( rx_handle->msg_data.msg_iov[0].iov_base );
 	free( rx_handle->msg_data.msg_iov );
 	free( rx_handle );
-	rx_array[ handle ] = NULL;
 }
 
 /*
  * Class:     com_rm5248_dbusjava_nativefd_NativeMessageReader
- * Method:    readNative
- * Signature: (I)Lcom/rm5248/dbus/java/nativefd/MsgHdr;
+ * Method:    openCapture
+ * Signature: (ILjava/lang/String;J)V
  */
-JNIEXPORT jobject JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_readNative
+JNIEXPORT void JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_openCapture
+  (JNIEnv * env, jobject obj, jint handle, jstring path, jlong size){
+	struct ReceiveHandle* rx_handle;
+	const char* path_chars;
+
+	rx_handle = handle_table_acquire( &rx_handles, handle );
+	if( rx_handle == NULL ){
+		jniutil_throw_ioexception( env, "Reader is closed" );
+		return;
+	}
+
+	path_chars = (*env)->GetStringUTFChars( env, path, NULL );
+	if( path_chars == NULL ){
+		handle_table_release( &rx_handles, handle );
+		return;
+	}
+
+	capture_close( rx_handle->capture );
+	rx_handle->capture = capture_open( path_chars, size );
+	if( rx_handle->capture == NULL ){
+		jniutil_throw_ioexception_errnum(env);
+	}
+
+	(*env)->ReleaseStringUTFChars( env, path, path_chars );
+	handle_table_release( &rx_handles, handle );
+}
+
+/*
+ * Class:     com_rm5248_dbusjava_nativefd_NativeMessageReader
+ * Method:    setAffinity
+ * Signature: (I[IZ)V
+ */
+JNIEXPORT void JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_setAffinity
+  (JNIEnv * env, jobject obj, jint handle, jintArray cpus, jboolean numa_local){
+	struct ReceiveHandle* rx_handle = handle_table_acquire( &rx_handles, handle );
+
+	if( rx_handle == NULL ){
+		return;
+	}
+
+	affinity_init( env, cpus, numa_local, &rx_handle->affinity );
+
+	/* Re-allocate our buffers with the new placement */
+	affinity_free( rx_handle->msg_data.msg_iov[0].iov_base );
+	rx_handle->msg_data.msg_iov[0].iov_base = affinity_alloc( &rx_handle->affinity, rx_handle->rx_iovlen );
+	affinity_free( rx_handle->msg_data.msg_control );
+	rx_handle->msg_data.msg_control = affinity_alloc( &rx_handle->affinity, rx_handle->rx_controllen );
+
+	handle_table_release( &rx_handles, handle );
+}
+
+/*
+ * Class:     com_rm5248_dbusjava_nativefd_NativeMessageReader
+ * Method:    sampleNative
+ * Signature: (I)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_sampleNative
   (JNIEnv * env, jobject obj, jint handle){
-	struct ReceiveHandle* rx_handle = rx_array[ handle ];
+	struct ReceiveHandle* rx_handle;
+	jlong sample[ 2 ];
+	jlongArray sample_array;
+
+	rx_handle = handle_table_acquire( &rx_handles, handle );
+	if( rx_handle == NULL ){
+		return NULL;
+	}
+	sample[ 0 ] = monitor_queued_bytes( rx_handle->fd, 0 );
+	sample[ 1 ] = monitor_idle_ns( &rx_handle->monitor );
+	handle_table_release( &rx_handles, handle );
+
+	sample_array = (*env)->NewLongArray( env, 2 );
+	(*env)->SetLongArrayRegion( env, sample_array, 0, 2, sample );
+
+	return sample_array;
+}
+
+/*
+ * Read one message from the socket, and create the MsgHdr for it.
+ */
+static jobject read_message( JNIEnv* env, struct ReceiveHandle* rx_handle ){
 	ssize_t ret;
 	ssize_t header_array_len;
 	ssize_t body_len;
 	ssize_t total_len;
-	ssize_t num_fds;
-	uint8_t* header_raw = rx_handle->msg_data.msg_iov[0].iov_base;
+	ssize_t num_fds = 0;
+	uint8_t* header_raw;
 	jclass msghdr_class;
 	jmethodID constructor_id;
 	jintArray fd_array = NULL;
 	jbyteArray data_array;
 	struct cmsghdr* cmsg;
 
+	affinity_apply( &rx_handle->affinity );
+
+	header_raw = rx_handle->msg_data.msg_iov[0].iov_base;
+
 	/* Do a peek of the data to determine if our arrays are large enough or not */
 	rx_handle->msg_data.msg_namelen = 0;
 	rx_handle->msg_data.msg_iov[0].iov_len = 16;
@@ -122,6 +208,11 @@ JNIEXPORT jobject JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_
 		jniutil_throw_ioexception_errnum(env);
 		return NULL;
 	}
+	if( ret == 0 ){
+		/* Our buffer still holds the last message, so don't look at it */
+		jniutil_throw_exception( env, JAVA_IO_EOFEXCEPTION, "Connection closed by the other end" );
+		return NULL;
+	}
 
 	jniutil_slf4j_log( env,
 		"com/rm5248/dbusjava/nativefd/NativeMessageReader",
@@ -171,8 +262,8 @@ JNIEXPORT jobject JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_
 
 	/* Check to see if our iovlen is big enough - expand if not */
 	if( rx_handle->rx_iovlen < total_len ){
-		free( rx_handle->msg_data.msg_iov[0].iov_base );
-		rx_handle->msg_data.msg_iov[0].iov_base = malloc( total_len );
+		affinity_free( rx_handle->msg_data.msg_iov[0].iov_base );
+		rx_handle->msg_data.msg_iov[0].iov_base = affinity_alloc( &rx_handle->affinity, total_len );
 		rx_handle->rx_iovlen = total_len;
 	}
 
@@ -181,11 +272,15 @@ JNIEXPORT jobject JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_
 	rx_handle->msg_data.msg_controllen = rx_handle->rx_controllen;
 
 	/* Do the real reading of the data */
-	ret = recvmsg( rx_handle->fd, &rx_handle->msg_data, 0 );
+	ret = recvmsg( rx_handle->fd, &rx_handle->msg_data, MSG_CMSG_CLOEXEC );
 	if( ret < 0 ){
 		jniutil_throw_ioexception_errnum(env);
 		return NULL;
 	}
+	if( ret == 0 ){
+		jniutil_throw_exception( env, JAVA_IO_EOFEXCEPTION, "Connection closed by the other end" );
+		return NULL;
+	}
 
 	/* Need to figure out how many FDs we have to create our array */
 	for( cmsg = CMSG_FIRSTHDR(&rx_handle->msg_data);
@@ -193,13 +288,56 @@ JNIEXPORT jobject JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_
 		cmsg = CMSG_NXTHDR(&rx_handle->msg_data, cmsg) ) {
 		if( cmsg->cmsg_level == SOL_SOCKET &&
 			cmsg->cmsg_type == SCM_RIGHTS ){
-			/* This is our FD array */
-			num_fds = CMSG_LEN( cmsg->cmsg_len ) / sizeof( int );
-			fd_array = (*env)->NewIntArray( env, num_fds );
-			(*env)->SetIntArrayRegion( env, fd_array, 0, num_fds, (int*)CMSG_DATA( cmsg ) );
+			num_fds += ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+		}
+	}
+
+	if( rx_handle->msg_data.msg_flags & MSG_CTRUNC ){
+		/* Some of the FDs were dropped by the kernel - close the ones that we
+		 * did get, as the message can't be used */
+		for( cmsg = CMSG_FIRSTHDR(&rx_handle->msg_data);
+			cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&rx_handle->msg_data, cmsg) ) {
+			if( cmsg->cmsg_level == SOL_SOCKET &&
+				cmsg->cmsg_type == SCM_RIGHTS ){
+				int* fds = (int*)CMSG_DATA( cmsg );
+				ssize_t x;
+				for( x = 0; x < (ssize_t)( ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int ) ); x++ ){
+					close( fds[ x ] );
+				}
+			}
+		}
+
+		jniutil_slf4j_log( env,
+			"com/rm5248/dbusjava/nativefd/NativeMessageReader",
+			"logger_native",
+			SLF4J_ERROR,
+			"Control data truncated, got %d FDs",
+			(int)num_fds );
+		jniutil_throw_ioexception( env, "Control data truncated: file descriptors were lost" );
+		return NULL;
+	}
+
+	if( num_fds > 0 ){
+		ssize_t fd_pos = 0;
+
+		fd_array = (*env)->NewIntArray( env, num_fds );
+		for( cmsg = CMSG_FIRSTHDR(&rx_handle->msg_data);
+			cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&rx_handle->msg_data, cmsg) ) {
+			if( cmsg->cmsg_level == SOL_SOCKET &&
+				cmsg->cmsg_type == SCM_RIGHTS ){
+				ssize_t cmsg_fds = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+				(*env)->SetIntArrayRegion( env, fd_array, fd_pos, cmsg_fds, (int*)CMSG_DATA( cmsg ) );
+				fd_pos += cmsg_fds;
+			}
 		}
 	}
 
+	if( rx_handle->capture != NULL ){
+		capture_record( rx_handle->capture, CAPTURE_DIRECTION_RX, rx_handle->msg_data.msg_iov[0].iov_base, total_len, num_fds );
+	}
+
 	/* Create the new Java object */
 	msghdr_class = (*env)->FindClass( env, "com/rm5248/dbusjava/nativefd/MsgHdr" );
 	constructor_id = (*env)->GetMethodID( env, msghdr_class, "<init>", "([B[I)V" );
@@ -208,3 +346,27 @@ JNIEXPORT jobject JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_
 	return (*env)->NewObject( env, msghdr_class, constructor_id, data_array, fd_array );
 }
 
+/*
+ * Class:     com_rm5248_dbusjava_nativefd_NativeMessageReader
+ * Method:    readNative
+ * Signature: (I)Lcom/rm5248/dbus/java/nativefd/MsgHdr;
+ */
+JNIEXPORT jobject JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageReader_readNative
+  (JNIEnv * env, jobject obj, jint handle){
+	struct ReceiveHandle* rx_handle = handle_table_acquire( &rx_handles, handle );
+	jobject msg;
+
+	if( rx_handle == NULL ){
+		jniutil_throw_ioexception( env, "Reader is closed" );
+		return NULL;
+	}
+
+	monitor_enter( &rx_handle->monitor );
+	msg = read_message( env, rx_handle );
+	monitor_leave( &rx_handle->monitor );
+
+	handle_table_release( &rx_handles, handle );
+
+	return msg;
+}
+
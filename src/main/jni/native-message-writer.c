@@ -4,9 +4,17 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "com_rm5248_dbusjava_nativefd_NativeMessageWriter.h"
 #include "jni_utils.h"
+#include "native-capture.h"
+#include "native-affinity.h"
+#include "native-monitor.h"
+#include "native-handles.h"
+
+/* The most file descriptors that the kernel will pass in one message(SCM_MAX_FD) */
+#define MAX_FDS_PER_MESSAGE 253
 
 struct SendHandle {
 	struct msghdr msg_data;
@@ -16,10 +24,12 @@ struct SendHandle {
 	int fd;
 	int* fd_array;
 	uint8_t* msg_raw;
+	struct CaptureRing* capture;
+	struct AffinitySettings affinity;
+	struct MonitorTimes monitor;
 };
 
-static struct SendHandle** tx_array = NULL;
-static int tx_array_length = 0;
+static struct HandleTable tx_handles = HANDLE_TABLE_INITIALIZER;
 
 /*
  * Class:     com_rm5248_dbusjava_nativefd_NativeMessageWriter
@@ -30,44 +40,22 @@ JNIEXPORT jint JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageWriter_ope
   (JNIEnv * env, jobject obj, jint fd){
 	struct SendHandle* new_tx_handle;
 	int list_pos;
-	int found = 0;
-
-	/* First time - allocate 10 SendHandles */
-	if( tx_array == NULL ){
-		tx_array = calloc( tx_array_length + 10, sizeof( struct SendHandle* ) );
-		tx_array_length = 10;
-	}
-
-	/* Look for a free index into our array */
-	for( list_pos = 0; list_pos < tx_array_length; list_pos++ ){
-		if( tx_array[ list_pos] == NULL ){
-			found = 1;
-			break;
-		}
-	}
-
-	if( !found ){
-		/* No free slots - expand our array by 10 elements */
-		struct SendHandle** new_tx_array = calloc( tx_array_length + 10, sizeof( struct SendHandle* ) );
-
-		for( list_pos = 0; list_pos < tx_array_length; list_pos++ ){
-			new_tx_array[ list_pos ] = tx_array[ list_pos ];
-		}
-		list_pos += 1;
-		tx_array_length += 10;
-
-		free( tx_array );
-		tx_array = new_tx_array;
-	}
 
 	new_tx_handle = malloc( sizeof( struct SendHandle ) );
 	memset( new_tx_handle, 0, sizeof( struct SendHandle ) );
 
 	new_tx_handle->fd = fd;
+	monitor_init( &new_tx_handle->monitor );
 	new_tx_handle->msg_data.msg_iov = &new_tx_handle->msg_iodata;
 	new_tx_handle->msg_data.msg_iovlen = 1;
 
-	tx_array[ list_pos ] = new_tx_handle;
+	list_pos = handle_table_add( &tx_handles, new_tx_handle );
+
+	if( list_pos < 0 ){
+		free( new_tx_handle );
+		jniutil_throw_ioexception( env, "Too many open connections" );
+		return -1;
+	}
 
 	return list_pos;
 }
@@ -79,39 +67,135 @@ JNIEXPORT jint JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageWriter_ope
  */
 JNIEXPORT void JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageWriter_closeNativeHandle
   (JNIEnv * env, jobject obj, jint handle){
-	struct SendHandle* tx_handle = tx_array[ handle ];
+	struct SendHandle* tx_handle = handle_table_remove( &tx_handles, handle );
+
+	if( tx_handle == NULL ){
+		return;
+	}
 
-	free( tx_handle->fd_array );
-	free( tx_handle->msg_raw );
+	/* Wake up a writer that is blocked in sendmsg, and wait for it to be
+	 * done with our buffers.  Only the sending side is shut down, as the
+	 * reader of the connection may still be receiving. */
+	shutdown( tx_handle->fd, SHUT_WR );
+	handle_table_wait( &tx_handles, handle );
+
+	capture_close( tx_handle->capture );
+	affinity_free( tx_handle->fd_array );
+	affinity_free( tx_handle->msg_raw );
 	free( tx_handle );
-	tx_array[ handle ] = NULL;
 }
 
 /*
  * Class:     com_rm5248_dbusjava_nativefd_NativeMessageWriter
- * Method:    writeNative
- * Signature: (I[B[I)V
+ * Method:    openCapture
+ * Signature: (ILjava/lang/String;J)V
  */
-JNIEXPORT void JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageWriter_writeNative
-  (JNIEnv * env, jobject obj, jint handle, jbyteArray bytedata, jintArray filedescriptors){
-	struct SendHandle* tx_handle = tx_array[ handle ];
+JNIEXPORT void JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageWriter_openCapture
+  (JNIEnv * env, jobject obj, jint handle, jstring path, jlong size){
+	struct SendHandle* tx_handle;
+	const char* path_chars;
+
+	tx_handle = handle_table_acquire( &tx_handles, handle );
+	if( tx_handle == NULL ){
+		jniutil_throw_ioexception( env, "Writer is closed" );
+		return;
+	}
+
+	path_chars = (*env)->GetStringUTFChars( env, path, NULL );
+	if( path_chars == NULL ){
+		handle_table_release( &tx_handles, handle );
+		return;
+	}
+
+	capture_close( tx_handle->capture );
+	tx_handle->capture = capture_open( path_chars, size );
+	if( tx_handle->capture == NULL ){
+		jniutil_throw_ioexception_errnum(env);
+	}
+
+	(*env)->ReleaseStringUTFChars( env, path, path_chars );
+	handle_table_release( &tx_handles, handle );
+}
+
+/*
+ * Class:     com_rm5248_dbusjava_nativefd_NativeMessageWriter
+ * Method:    setAffinity
+ * Signature: (I[IZ)V
+ */
+JNIEXPORT void JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageWriter_setAffinity
+  (JNIEnv * env, jobject obj, jint handle, jintArray cpus, jboolean numa_local){
+	struct SendHandle* tx_handle = handle_table_acquire( &tx_handles, handle );
+
+	if( tx_handle == NULL ){
+		return;
+	}
+
+	affinity_init( env, cpus, numa_local, &tx_handle->affinity );
+
+	/* Our buffers are allocated with the new placement on the next write */
+	affinity_free( tx_handle->msg_raw );
+	affinity_free( tx_handle->fd_array );
+	tx_handle->msg_raw = NULL;
+	tx_handle->fd_array = NULL;
+	tx_handle->tx_iovlen = 0;
+	tx_handle->tx_fdlen = 0;
+
+	handle_table_release( &tx_handles, handle );
+}
+
+/*
+ * Class:     com_rm5248_dbusjava_nativefd_NativeMessageWriter
+ * Method:    sampleNative
+ * Signature: (I)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageWriter_sampleNative
+  (JNIEnv * env, jobject obj, jint handle){
+	struct SendHandle* tx_handle;
+	jlong sample[ 2 ];
+	jlongArray sample_array;
+
+	tx_handle = handle_table_acquire( &tx_handles, handle );
+	if( tx_handle == NULL ){
+		return NULL;
+	}
+	sample[ 0 ] = monitor_queued_bytes( tx_handle->fd, 1 );
+	sample[ 1 ] = monitor_busy_ns( &tx_handle->monitor );
+	handle_table_release( &tx_handles, handle );
+
+	sample_array = (*env)->NewLongArray( env, 2 );
+	(*env)->SetLongArrayRegion( env, sample_array, 0, 2, sample );
+
+	return sample_array;
+}
+
+/*
+ * Send one message over the socket.
+ */
+static void write_message( JNIEnv* env, struct SendHandle* tx_handle, jbyteArray bytedata, jintArray filedescriptors ){
 	int message_size = (*env)->GetArrayLength( env, bytedata );
 	int fds_size = (*env)->GetArrayLength( env, filedescriptors );
 	struct cmsghdr* cmsg;
 	int fd_space_needed = CMSG_SPACE( sizeof( int ) * fds_size );
 
+	if( fds_size > MAX_FDS_PER_MESSAGE ){
+		jniutil_throw_ioexception( env, "Too many file descriptors for one message" );
+		return;
+	}
+
 	/* Make sure our data buffer is big enough and set the location */
 	if( tx_handle->tx_iovlen < message_size ){
-		free( tx_handle->msg_raw );
-		tx_handle->msg_raw = malloc( message_size );
+		affinity_free( tx_handle->msg_raw );
+		tx_handle->msg_raw = affinity_alloc( &tx_handle->affinity, message_size );
+		tx_handle->tx_iovlen = message_size;
 	}
 	tx_handle->msg_iodata.iov_base = tx_handle->msg_raw;
 	tx_handle->msg_iodata.iov_len = message_size;
 
 	/* Make sure our FD array is large enough */
 	if( tx_handle->tx_fdlen < fd_space_needed ){
-		free( tx_handle->fd_array );
-		tx_handle->fd_array = malloc( fd_space_needed );
+		affinity_free( tx_handle->fd_array );
+		tx_handle->fd_array = affinity_alloc( &tx_handle->affinity, fd_space_needed );
+		tx_handle->tx_fdlen = fd_space_needed;
 	}
 
 	/* Fill in our FD array(ancillary data) */
@@ -123,6 +207,10 @@ JNIEXPORT void JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageWriter_wri
 		cmsg->cmsg_type = SCM_RIGHTS;
 		cmsg->cmsg_len = CMSG_LEN( sizeof( int ) * fds_size );
 		(*env)->GetIntArrayRegion( env, filedescriptors, 0, fds_size, (int*)CMSG_DATA( cmsg ) );
+	}else{
+		/* Don't send the FDs of the last message again */
+		tx_handle->msg_data.msg_control = NULL;
+		tx_handle->msg_data.msg_controllen = 0;
 	}
 
 	/* Fill in our data array */
@@ -137,7 +225,35 @@ JNIEXPORT void JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageWriter_wri
 		fds_size );
 
 	/* Now we finally send the data! */
-	if( sendmsg( tx_handle->fd, &tx_handle->msg_data, 0 ) < 0 ){
+	monitor_enter( &tx_handle->monitor );
+	/* Our socket may have been shut down by a close, which must not raise SIGPIPE */
+	if( sendmsg( tx_handle->fd, &tx_handle->msg_data, MSG_NOSIGNAL ) < 0 ){
+		monitor_leave( &tx_handle->monitor );
 		jniutil_throw_ioexception_errnum(env);
+		return;
+	}
+	monitor_leave( &tx_handle->monitor );
+
+	if( tx_handle->capture != NULL ){
+		capture_record( tx_handle->capture, CAPTURE_DIRECTION_TX, tx_handle->msg_raw, message_size, fds_size );
+	}
+}
+
+/*
+ * Class:     com_rm5248_dbusjava_nativefd_NativeMessageWriter
+ * Method:    writeNative
+ * Signature: (I[B[I)V
+ */
+JNIEXPORT void JNICALL Java_com_rm5248_dbusjava_nativefd_NativeMessageWriter_writeNative
+  (JNIEnv * env, jobject obj, jint handle, jbyteArray bytedata, jintArray filedescriptors){
+	struct SendHandle* tx_handle = handle_table_acquire( &tx_handles, handle );
+
+	if( tx_handle == NULL ){
+		jniutil_throw_ioexception( env, "Writer is closed" );
+		return;
 	}
+
+	write_message( env, tx_handle, bytedata, filedescriptors );
+
+	handle_table_release( &tx_handles, handle );
 }
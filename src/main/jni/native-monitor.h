@@ -0,0 +1,88 @@
+#ifndef NATIVE_MONITOR_H
+#define NATIVE_MONITOR_H
+
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Tracking of how long the reader or the writer of a connection has been
+ * inside(or outside) of the native code, so that a sampler on another thread
+ * can tell if a connection is stalled.
+ *
+ * The times are only written by the thread doing the I/O, and read without
+ * locking by the sampler.
+ */
+struct MonitorTimes {
+	/* CLOCK_MONOTONIC time that we last entered the I/O call */
+	uint64_t busy_since_ns;
+	/* CLOCK_MONOTONIC time that we last returned from the I/O call */
+	uint64_t idle_since_ns;
+	int busy;
+};
+
+static inline uint64_t monitor_now_ns( void ){
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static inline void monitor_init( struct MonitorTimes* times ){
+	__atomic_store_n( &times->idle_since_ns, monitor_now_ns(), __ATOMIC_RELAXED );
+	__atomic_store_n( &times->busy, 0, __ATOMIC_RELEASE );
+}
+
+static inline void monitor_enter( struct MonitorTimes* times ){
+	__atomic_store_n( &times->busy_since_ns, monitor_now_ns(), __ATOMIC_RELAXED );
+	__atomic_store_n( &times->busy, 1, __ATOMIC_RELEASE );
+}
+
+static inline void monitor_leave( struct MonitorTimes* times ){
+	__atomic_store_n( &times->idle_since_ns, monitor_now_ns(), __ATOMIC_RELAXED );
+	__atomic_store_n( &times->busy, 0, __ATOMIC_RELEASE );
+}
+
+/**
+ * @return How long we have been inside of the I/O call, or 0 if we are not in it
+ */
+static inline uint64_t monitor_busy_ns( struct MonitorTimes* times ){
+	if( !__atomic_load_n( &times->busy, __ATOMIC_ACQUIRE ) ){
+		return 0;
+	}
+
+	return monitor_now_ns() - __atomic_load_n( &times->busy_since_ns, __ATOMIC_RELAXED );
+}
+
+/**
+ * @return How long it has been since we returned from the I/O call, or 0 if we are in it
+ */
+static inline uint64_t monitor_idle_ns( struct MonitorTimes* times ){
+	if( __atomic_load_n( &times->busy, __ATOMIC_ACQUIRE ) ){
+		return 0;
+	}
+
+	return monitor_now_ns() - __atomic_load_n( &times->idle_since_ns, __ATOMIC_RELAXED );
+}
+
+/**
+ * Get the number of bytes that are queued on the socket.
+ *
+ * @param fd The socket
+ * @param outgoing True for the bytes not yet sent(SIOCOUTQ), false for the
+ * bytes not yet read(SIOCINQ)
+ * @return The number of bytes, or -1 if unknown
+ */
+static inline int monitor_queued_bytes( int fd, int outgoing ){
+	int queued = -1;
+
+	if( ioctl( fd, outgoing ? SIOCOUTQ : SIOCINQ, &queued ) < 0 ){
+		return -1;
+	}
+
+	return queued;
+}
+
+#endif
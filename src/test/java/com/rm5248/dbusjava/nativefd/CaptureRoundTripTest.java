@@ -0,0 +1,125 @@
+package com.rm5248.dbusjava.nativefd;
+
+import static org.junit.jupiter.api.Assertions.assertArrayEquals;
+import static org.junit.jupiter.api.Assertions.assertEquals;
+import static org.junit.jupiter.api.Assertions.assertThrows;
+import static org.junit.jupiter.api.Assertions.assertTrue;
+
+import java.io.IOException;
+import java.nio.file.Path;
+import java.util.Arrays;
+import java.util.List;
+
+import org.freedesktop.dbus.FileDescriptor;
+import org.freedesktop.dbus.messages.Message;
+import org.junit.jupiter.api.Test;
+import org.junit.jupiter.api.Timeout;
+import org.junit.jupiter.api.io.TempDir;
+
+import jnr.constants.platform.AddressFamily;
+import jnr.constants.platform.OpenFlags;
+import jnr.constants.platform.Sock;
+import jnr.posix.POSIXFactory;
+
+/**
+ * Captures messages into a ring that is small enough to wrap, and makes sure
+ * that CaptureReplay reads back what the native code wrote.
+ */
+public class CaptureRoundTripTest {
+
+    private static jnr.posix.POSIX POSIX = POSIXFactory.getPOSIX();
+
+    private static final int RING_SIZE = 4096;
+    private static final int NUM_MESSAGES = 64;
+
+    @TempDir
+    Path tempDir;
+
+    @Test
+    public void testCaptureWrapsAndReplays() throws Exception {
+        int[] sockets = { 0, 0 };
+        byte[][] sent = new byte[ NUM_MESSAGES ][];
+        Path captureFile = tempDir.resolve( "roundtrip.cap" );
+
+        NativeSocketProvider.ensureNativeLibraryLoaded();
+
+        assertTrue( POSIX.socketpair( AddressFamily.AF_UNIX.intValue(), Sock.SOCK_STREAM.intValue(), 0, sockets ) >= 0 );
+        int devNull = POSIX.open( "/dev/null", OpenFlags.O_RDONLY.intValue(), 0 );
+        assertTrue( devNull >= 0 );
+
+        NativeMessageWriter writer = new NativeMessageWriter( sockets[ 0 ] );
+        NativeMessageReader reader = new NativeMessageReader( sockets[ 1 ] );
+        try{
+            reader.startCapture( captureFile.toString(), RING_SIZE );
+
+            for( int x = 0; x < NUM_MESSAGES; x++ ){
+                // Every fifth message carries a file descriptor, to check the FD count of a record
+                int numFds = x % 5 == 0 ? 1 : 0;
+                int[] fds = new int[ numFds ];
+                Arrays.fill( fds, devNull );
+
+                sent[ x ] = RawMessageBuilder.methodCall( x + 1, "/com/rm5248/dbusjava/Capture/" + x, "Ping", numFds );
+                writer.writeRaw( sent[ x ], fds );
+
+                Message m = reader.readMessage();
+                for( FileDescriptor fd : m.getFiledescriptors() ){
+                    POSIX.close( fd.getIntFileDescriptor() );
+                }
+            }
+        } finally{
+            writer.close();
+            reader.close();
+            POSIX.close( devNull );
+        }
+
+        List<CaptureReplay.Record> records = CaptureReplay.readCapture( captureFile );
+        long totalSent = 0;
+        for( byte[] s : sent ){
+            totalSent += s.length;
+        }
+
+        // The ring must have wrapped, so the oldest messages are gone
+        assertTrue( totalSent > RING_SIZE, "Messages don't fill the ring" );
+        assertTrue( records.size() > 0 && records.size() < NUM_MESSAGES );
+
+        // What is left must be the newest messages, in order, with their data intact
+        long firstSequence = NUM_MESSAGES - records.size();
+        for( int x = 0; x < records.size(); x++ ){
+            CaptureReplay.Record r = records.get( x );
+            int sequence = (int)( firstSequence + x );
+
+            assertEquals( sequence, r.getSequence() );
+            assertEquals( CaptureReplay.DIRECTION_RX, r.getDirection() );
+            assertEquals( sequence % 5 == 0 ? 1 : 0, r.getNumFds() );
+            assertArrayEquals( sent[ sequence ], r.getData() );
+        }
+
+        assertEquals( records.size(), CaptureReplay.replay( records, true ) );
+    }
+
+    @Test
+    @Timeout( 30 )
+    public void testReplayFailsWhenWriteFails(){
+        byte[] message = RawMessageBuilder.methodCall( 1, "/com/rm5248/dbusjava/Capture", "Ping", 0 );
+        // The writer can't send more than 253 FDs, so the second message fails
+        // and the reader must not wait for it forever
+        List<CaptureReplay.Record> records = Arrays.asList(
+                new CaptureReplay.Record( 0, 0, CaptureReplay.DIRECTION_RX, 0, message ),
+                new CaptureReplay.Record( 1, 0, CaptureReplay.DIRECTION_RX, 254, message ) );
+
+        NativeSocketProvider.ensureNativeLibraryLoaded();
+
+        IOException e = assertThrows( IOException.class, () -> CaptureReplay.replay( records, true ) );
+        assertEquals( "Unable to write messages", e.getMessage() );
+    }
+
+    @Test
+    public void testRejectsOversizedCapture(){
+        NativeSocketProvider provider = new NativeSocketProvider();
+
+        assertThrows( IllegalArgumentException.class,
+                () -> provider.setCapture( tempDir.toFile(), NativeSocketProvider.MAX_CAPTURE_SIZE + 1 ) );
+        assertThrows( IllegalArgumentException.class,
+                () -> provider.setCapture( tempDir.toFile(), 3L * 1024 * 1024 * 1024 ) );
+    }
+}
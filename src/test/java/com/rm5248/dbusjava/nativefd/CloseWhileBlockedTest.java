@@ -0,0 +1,96 @@
+package com.rm5248.dbusjava.nativefd;
+
+import static org.junit.jupiter.api.Assertions.assertThrows;
+import static org.junit.jupiter.api.Assertions.assertTrue;
+
+import java.io.IOException;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.TimeUnit;
+
+import org.junit.jupiter.api.AfterEach;
+import org.junit.jupiter.api.BeforeEach;
+import org.junit.jupiter.api.Test;
+import org.junit.jupiter.api.Timeout;
+
+import jnr.constants.platform.AddressFamily;
+import jnr.constants.platform.Sock;
+import jnr.posix.POSIXFactory;
+
+/**
+ * Closes readers and writers while another thread is blocked in them, like
+ * dbus-java does when it disconnects.  The blocked call must wake up with an
+ * error, instead of using the freed native data once the socket has data.
+ */
+@Timeout( 30 )
+public class CloseWhileBlockedTest {
+
+    private static jnr.posix.POSIX POSIX = POSIXFactory.getPOSIX();
+
+    private int[] sockets = { 0, 0 };
+
+    @BeforeEach
+    public void before(){
+        NativeSocketProvider.ensureNativeLibraryLoaded();
+        assertTrue( POSIX.socketpair( AddressFamily.AF_UNIX.intValue(), Sock.SOCK_STREAM.intValue(), 0, sockets ) >= 0 );
+    }
+
+    @AfterEach
+    public void after(){
+        POSIX.close( sockets[ 0 ] );
+        POSIX.close( sockets[ 1 ] );
+    }
+
+    @Test
+    public void testCloseBlockedReader() throws Exception {
+        // Like the provider, leave the socket to its owner
+        NativeMessageReader reader = new NativeMessageReader( sockets[ 1 ], false );
+        CompletableFuture<MsgHdr> read = CompletableFuture.supplyAsync( () -> {
+            try{
+                return reader.readMsgHdr();
+            } catch( IOException e ){
+                throw new RuntimeException( e );
+            }
+        } );
+
+        waitUntilBlocked( read );
+        reader.close();
+
+        ExecutionException e = assertThrows( ExecutionException.class, () -> read.get( 10, TimeUnit.SECONDS ) );
+        assertTrue( e.getCause().getCause() instanceof IOException, e.toString() );
+
+        // Data that arrives now must not be read through the closed reader
+        NativeMessageWriter writer = new NativeMessageWriter( sockets[ 0 ], false );
+        writer.writeRaw( RawMessageBuilder.methodCall( 1, "/com/rm5248/dbusjava/Close", "Late", 0 ), new int[ 0 ] );
+        writer.close();
+        assertThrows( IOException.class, () -> reader.readMsgHdr() );
+    }
+
+    @Test
+    public void testCloseBlockedWriter() throws Exception {
+        NativeMessageWriter writer = new NativeMessageWriter( sockets[ 0 ], false );
+        // Nobody reads the other end, so this fills the socket and blocks
+        byte[] data = new byte[ 1024 * 1024 ];
+        CompletableFuture<Void> write = CompletableFuture.runAsync( () -> {
+            try{
+                while( true ){
+                    writer.writeRaw( data, new int[ 0 ] );
+                }
+            } catch( IOException e ){
+                throw new RuntimeException( e );
+            }
+        } );
+
+        waitUntilBlocked( write );
+        writer.close();
+
+        ExecutionException e = assertThrows( ExecutionException.class, () -> write.get( 10, TimeUnit.SECONDS ) );
+        assertTrue( e.getCause().getCause() instanceof IOException, e.toString() );
+        assertThrows( IOException.class, () -> writer.writeRaw( data, new int[ 0 ] ) );
+    }
+
+    private static void waitUntilBlocked( CompletableFuture<?> future ) throws InterruptedException {
+        Thread.sleep( 200 );
+        assertTrue( !future.isDone(), "The call did not block" );
+    }
+}
@@ -0,0 +1,37 @@
+package com.rm5248.dbusjava.nativefd;
+
+import static org.junit.jupiter.api.Assertions.assertArrayEquals;
+import static org.junit.jupiter.api.Assertions.assertThrows;
+
+import org.junit.jupiter.api.Test;
+
+/**
+ * Parsing of the CPU lists given in com.rm5248.dbusnative.cpus.
+ */
+public class CpuListTest {
+
+    @Test
+    public void testValidLists(){
+        assertArrayEquals( new int[]{ 2 }, NativeSocketProvider.parseCpuList( "2" ) );
+        assertArrayEquals( new int[]{ 0, 1, 2, 3, 8, 10, 11 }, NativeSocketProvider.parseCpuList( "0-3,8,10-11" ) );
+        assertArrayEquals( new int[]{ 4, 5 }, NativeSocketProvider.parseCpuList( " 4 - 5 , " ) );
+    }
+
+    @Test
+    public void testInvalidLists(){
+        for( String invalid : new String[]{ "", ",", "x", "1,x", "-1", "3-1", "0-99999999", "1-", "1024" } ){
+            assertThrows( IllegalArgumentException.class, () -> NativeSocketProvider.parseCpuList( invalid ), invalid );
+        }
+    }
+
+    @Test
+    public void testInvalidPropertyDoesNotBreakProvider(){
+        System.setProperty( "com.rm5248.dbusnative.cpus", "3-1" );
+        try{
+            // Only logs an error, as this is created by ServiceLoader for every connection
+            new NativeSocketProvider();
+        } finally{
+            System.clearProperty( "com.rm5248.dbusnative.cpus" );
+        }
+    }
+}
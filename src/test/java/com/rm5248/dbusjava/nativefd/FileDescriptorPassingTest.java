@@ -0,0 +1,110 @@
+package com.rm5248.dbusjava.nativefd;
+
+import static org.junit.jupiter.api.Assertions.assertEquals;
+import static org.junit.jupiter.api.Assertions.assertThrows;
+import static org.junit.jupiter.api.Assertions.assertTrue;
+
+import java.io.IOException;
+import java.util.Arrays;
+
+import org.freedesktop.dbus.FileDescriptor;
+import org.freedesktop.dbus.messages.Message;
+import org.junit.jupiter.api.Test;
+import org.junit.jupiter.params.ParameterizedTest;
+import org.junit.jupiter.params.provider.ValueSource;
+import org.slf4j.Logger;
+import org.slf4j.LoggerFactory;
+
+import jnr.constants.platform.AddressFamily;
+import jnr.constants.platform.OpenFlags;
+import jnr.constants.platform.Sock;
+import jnr.posix.POSIXFactory;
+
+/**
+ * Sends messages with many file descriptors through the native writer and
+ * reader over a socketpair, making sure that no FDs are lost.
+ *
+ * Running this class' main method benchmarks the same path with many more
+ * messages, and logs the throughput.
+ */
+public class FileDescriptorPassingTest {
+
+    private static jnr.posix.POSIX POSIX = POSIXFactory.getPOSIX();
+    private static final Logger logger = LoggerFactory.getLogger( FileDescriptorPassingTest.class );
+
+    private static final int MESSAGES_PER_TEST = 10;
+    private static final int MESSAGES_PER_BENCHMARK = 2000;
+
+    @ParameterizedTest
+    @ValueSource( ints = { 0, 1, 16, 128, 253 } )
+    public void testFileDescriptorsArrive( int numFds ) throws Exception {
+        sendAndReceive( numFds, MESSAGES_PER_TEST );
+    }
+
+    @Test
+    public void testTooManyFileDescriptors() throws Exception {
+        int[] sockets = { 0, 0 };
+
+        NativeSocketProvider.ensureNativeLibraryLoaded();
+        assertTrue( POSIX.socketpair( AddressFamily.AF_UNIX.intValue(), Sock.SOCK_STREAM.intValue(), 0, sockets ) >= 0 );
+
+        NativeMessageWriter writer = new NativeMessageWriter( sockets[ 0 ] );
+        try{
+            int[] fds = new int[ 254 ];
+            Arrays.fill( fds, sockets[ 1 ] );
+
+            assertThrows( IOException.class,
+                    () -> writer.writeRaw( RawMessageBuilder.methodCall( 1, "/com/rm5248/dbusjava/Fds", "TakeFds", 254 ), fds ) );
+        } finally{
+            writer.close();
+            POSIX.close( sockets[ 1 ] );
+        }
+    }
+
+    /**
+     * Send numMessages messages that each carry numFds file descriptors, and
+     * check that all of them arrive.
+     */
+    private static void sendAndReceive( int numFds, int numMessages ) throws Exception {
+        int[] sockets = { 0, 0 };
+        int[] fds = new int[ numFds ];
+        byte[] message = RawMessageBuilder.methodCall( 1, "/com/rm5248/dbusjava/Fds", "TakeFds", numFds );
+
+        NativeSocketProvider.ensureNativeLibraryLoaded();
+
+        assertTrue( POSIX.socketpair( AddressFamily.AF_UNIX.intValue(), Sock.SOCK_STREAM.intValue(), 0, sockets ) >= 0 );
+        int devNull = POSIX.open( "/dev/null", OpenFlags.O_RDONLY.intValue(), 0 );
+        assertTrue( devNull >= 0 );
+        Arrays.fill( fds, devNull );
+
+        NativeMessageWriter writer = new NativeMessageWriter( sockets[ 0 ] );
+        NativeMessageReader reader = new NativeMessageReader( sockets[ 1 ] );
+        try{
+            for( int x = 0; x < numMessages; x++ ){
+                writer.writeRaw( message, fds );
+                Message m = reader.readMessage();
+
+                assertEquals( numFds, m.getFiledescriptors().size() );
+                for( FileDescriptor fd : m.getFiledescriptors() ){
+                    assertTrue( fd.getIntFileDescriptor() >= 0 );
+                    POSIX.close( fd.getIntFileDescriptor() );
+                }
+            }
+        } finally{
+            writer.close();
+            reader.close();
+            POSIX.close( devNull );
+        }
+    }
+
+    public static void main( String[] args ) throws Exception {
+        for( int numFds : new int[]{ 1, 16, 128, 253 } ){
+            long start = System.nanoTime();
+            sendAndReceive( numFds, MESSAGES_PER_BENCHMARK );
+            double seconds = ( System.nanoTime() - start ) / 1e9;
+
+            logger.info( String.format( "%d FDs/message: %.0f messages/s, %.0f FDs/s",
+                    numFds, MESSAGES_PER_BENCHMARK / seconds, MESSAGES_PER_BENCHMARK * numFds / seconds ) );
+        }
+    }
+}
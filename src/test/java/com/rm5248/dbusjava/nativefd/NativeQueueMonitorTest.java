@@ -0,0 +1,200 @@
+package com.rm5248.dbusjava.nativefd;
+
+import static org.junit.jupiter.api.Assertions.assertEquals;
+import static org.junit.jupiter.api.Assertions.assertNotNull;
+import static org.junit.jupiter.api.Assertions.assertNull;
+import static org.junit.jupiter.api.Assertions.assertSame;
+import static org.junit.jupiter.api.Assertions.assertTrue;
+
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.Collections;
+import java.util.List;
+import java.util.concurrent.TimeUnit;
+
+import org.junit.jupiter.api.BeforeEach;
+import org.junit.jupiter.api.Test;
+
+import jnr.constants.platform.AddressFamily;
+import jnr.constants.platform.Sock;
+import jnr.posix.POSIXFactory;
+
+/**
+ * Feeds made-up gauges through a NativeQueueMonitor, and checks when it
+ * reports connections as stalled and recovered.  The gauges of a real
+ * connection are checked over a socketpair.
+ */
+public class NativeQueueMonitorTest {
+
+    private static jnr.posix.POSIX POSIX = POSIXFactory.getPOSIX();
+
+    private static final long QUEUE_THRESHOLD = 4096;
+    private static final long STALL_THRESHOLD = 1_000_000_000L;
+
+    // The fds are never used, as the gauges are not sampled from the sockets
+    private final NativeConnection connection = new NativeConnection( 1000 );
+    private final NativeConnection otherConnection = new NativeConnection( 1001 );
+
+    private List<QueueGauges> gauges;
+    private List<String> events;
+    private NativeQueueMonitor monitor;
+
+    @BeforeEach
+    public void before(){
+        gauges = Collections.emptyList();
+        events = new ArrayList<String>();
+        monitor = createMonitor( QUEUE_THRESHOLD, STALL_THRESHOLD );
+    }
+
+    private NativeQueueMonitor createMonitor( long queueThreshold, long stallThreshold ){
+        NativeQueueMonitor m = new NativeQueueMonitor( () -> gauges, queueThreshold, stallThreshold );
+
+        m.addListener( new QueueStallListener(){
+            @Override
+            public void queueStalled( QueueGauges g ){
+                events.add( "stalled " + g.getConnection().getFileDescriptor() );
+            }
+
+            @Override
+            public void queueRecovered( QueueGauges g ){
+                events.add( "recovered " + g.getConnection().getFileDescriptor() );
+            }
+        } );
+
+        return m;
+    }
+
+    private void sample( QueueGauges... sample ){
+        gauges = Arrays.asList( sample );
+        monitor.sample();
+    }
+
+    private static QueueGauges gauges( NativeConnection c, long rxQueue, long readerIdle, long txQueue, long writerBlocked ){
+        return new QueueGauges( c, new long[]{ rxQueue, readerIdle }, new long[]{ txQueue, writerBlocked } );
+    }
+
+    @Test
+    public void testHealthyConnection(){
+        sample( gauges( connection, 0, 10 * STALL_THRESHOLD, 0, 0 ) );
+        sample( gauges( connection, QUEUE_THRESHOLD - 1, 0, QUEUE_THRESHOLD - 1, STALL_THRESHOLD - 1 ) );
+
+        assertEquals( Collections.emptyList(), events );
+    }
+
+    @Test
+    public void testReceiveQueueStallsAndRecovers(){
+        sample( gauges( connection, QUEUE_THRESHOLD, 0, 0, 0 ) );
+        sample( gauges( connection, QUEUE_THRESHOLD * 2, 0, 0, 0 ) );
+        sample( gauges( connection, 0, 0, 0, 0 ) );
+        sample( gauges( connection, 0, 0, 0, 0 ) );
+
+        // Only the transitions are reported
+        assertEquals( Arrays.asList( "stalled 1000", "recovered 1000" ), events );
+    }
+
+    @Test
+    public void testSendQueueStalls(){
+        sample( gauges( connection, 0, 0, QUEUE_THRESHOLD, 0 ) );
+
+        assertEquals( Arrays.asList( "stalled 1000" ), events );
+    }
+
+    @Test
+    public void testIdleReaderWithDataStalls(){
+        // An idle reader with nothing to read is fine
+        sample( gauges( connection, 0, STALL_THRESHOLD, 0, 0 ) );
+        sample( gauges( connection, 1, STALL_THRESHOLD, 0, 0 ) );
+        sample( gauges( connection, 0, STALL_THRESHOLD, 0, 0 ) );
+
+        assertEquals( Arrays.asList( "stalled 1000", "recovered 1000" ), events );
+    }
+
+    @Test
+    public void testBlockedWriterStalls(){
+        sample( gauges( connection, 0, 0, 0, STALL_THRESHOLD ) );
+        sample( gauges( connection, 0, 0, 0, 0 ) );
+
+        assertEquals( Arrays.asList( "stalled 1000", "recovered 1000" ), events );
+    }
+
+    @Test
+    public void testConnectionsAreTrackedSeparately(){
+        sample( gauges( connection, QUEUE_THRESHOLD, 0, 0, 0 ), gauges( otherConnection, 0, 0, 0, 0 ) );
+        sample( gauges( connection, QUEUE_THRESHOLD, 0, 0, 0 ), gauges( otherConnection, 0, 0, 0, STALL_THRESHOLD ) );
+        sample( gauges( connection, 0, 0, 0, 0 ), gauges( otherConnection, 0, 0, 0, STALL_THRESHOLD ) );
+
+        assertEquals( Arrays.asList( "stalled 1000", "stalled 1001", "recovered 1000" ), events );
+        assertEquals( 2, monitor.getGauges().size() );
+        assertSame( otherConnection, monitor.getGauges().get( 1 ).getConnection() );
+    }
+
+    @Test
+    public void testClosedConnectionIsForgotten(){
+        sample( gauges( connection, QUEUE_THRESHOLD, 0, 0, 0 ) );
+        // The connection was closed while stalled: no recovery is reported
+        sample();
+        // A new stall after it comes back is reported again
+        sample( gauges( connection, QUEUE_THRESHOLD, 0, 0, 0 ) );
+
+        assertEquals( Arrays.asList( "stalled 1000", "stalled 1000" ), events );
+    }
+
+    @Test
+    public void testZeroThresholdsDisableChecks(){
+        monitor = createMonitor( 0, 0 );
+
+        sample( gauges( connection, Long.MAX_VALUE, Long.MAX_VALUE, Long.MAX_VALUE, Long.MAX_VALUE ) );
+
+        assertEquals( Collections.emptyList(), events );
+        assertEquals( 1, monitor.getGauges().size() );
+    }
+
+    @Test
+    public void testSocketGauges() throws Exception {
+        int[] sockets = { 0, 0 };
+
+        NativeSocketProvider.ensureNativeLibraryLoaded();
+        assertTrue( POSIX.socketpair( AddressFamily.AF_UNIX.intValue(), Sock.SOCK_STREAM.intValue(), 0, sockets ) >= 0 );
+
+        NativeMessageWriter writer = new NativeMessageWriter( sockets[ 0 ] );
+        NativeMessageReader reader = new NativeMessageReader( sockets[ 1 ] );
+        try{
+            byte[] message = RawMessageBuilder.methodCall( 1, "/com/rm5248/dbusjava/Monitor", "Ping", 0 );
+            writer.writeRaw( message, new int[ 0 ] );
+
+            // Nobody has read the message yet
+            long[] first = reader.sample();
+            assertNotNull( first );
+            assertEquals( message.length, first[ 0 ] );
+            assertTrue( writer.sample()[ 0 ] > 0, "Nothing queued on the sending side" );
+            // The writer is not blocked in sendmsg
+            assertEquals( 0, writer.sample()[ 1 ] );
+
+            Thread.sleep( 50 );
+            long[] second = reader.sample();
+            assertEquals( message.length, second[ 0 ] );
+            assertTrue( second[ 1 ] - first[ 1 ] >= TimeUnit.MILLISECONDS.toNanos( 40 ),
+                    "Idle time did not grow: " + first[ 1 ] + " -> " + second[ 1 ] );
+
+            // So the monitor sees the connection as stalled
+            NativeConnection socketConnection = new NativeConnection( sockets[ 1 ] );
+            gauges = Collections.singletonList( new QueueGauges( socketConnection, second, writer.sample() ) );
+            NativeQueueMonitor socketMonitor = createMonitor( 0, TimeUnit.MILLISECONDS.toNanos( 40 ) );
+            socketMonitor.sample();
+            assertEquals( Arrays.asList( "stalled " + sockets[ 1 ] ), events );
+
+            // Reading the message empties the queue and restarts the idle time
+            reader.readMsgHdr();
+            long[] afterRead = reader.sample();
+            assertEquals( 0, afterRead[ 0 ] );
+            assertTrue( afterRead[ 1 ] < second[ 1 ] );
+            assertEquals( 0, writer.sample()[ 0 ] );
+        } finally{
+            writer.close();
+            reader.close();
+        }
+
+        assertNull( reader.sample() );
+        assertNull( writer.sample() );
+    }
+}
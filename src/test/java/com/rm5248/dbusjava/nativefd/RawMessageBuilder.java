@@ -0,0 +1,96 @@
+package com.rm5248.dbusjava.nativefd;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.util.Arrays;
+
+import org.freedesktop.dbus.messages.Message;
+
+/**
+ * Builds the wire data of little-endian method calls by hand, so that tests can
+ * write messages straight into a socket with NativeMessageWriter.writeRaw.
+ */
+class RawMessageBuilder {
+
+    private final ByteBuffer m_buf;
+    private int m_numFds;
+
+    RawMessageBuilder( int serial ){
+        m_buf = ByteBuffer.allocate( 64 * 1024 ).order( ByteOrder.LITTLE_ENDIAN );
+
+        m_buf.put( (byte)'l' ).put( Message.MessageType.METHOD_CALL ).put( (byte)0 ).put( Message.PROTOCOL );
+        m_buf.putInt( 0 ); // body length, filled in by build()
+        m_buf.putInt( serial );
+        m_buf.putInt( 0 ); // header array length, filled in by build()
+    }
+
+    /**
+     * Create a method call with a path and a member, that takes an array of
+     * numFds file descriptors.
+     */
+    static byte[] methodCall( int serial, String path, String member, int numFds ){
+        return new RawMessageBuilder( serial )
+                .stringField( Message.HeaderField.PATH, 'o', path )
+                .stringField( Message.HeaderField.MEMBER, 's', member )
+                .fileDescriptors( numFds )
+                .build();
+    }
+
+    /**
+     * Add a header field with a string value.
+     *
+     * @param field The header field code
+     * @param type The type of the value, 's' or 'o'
+     * @param value The value
+     */
+    RawMessageBuilder stringField( byte field, char type, String value ){
+        byte[] bytes = value.getBytes( StandardCharsets.UTF_8 );
+
+        align( 8 );
+        m_buf.put( field ).put( (byte)1 ).put( (byte)type ).put( (byte)0 );
+        m_buf.putInt( bytes.length );
+        m_buf.put( bytes ).put( (byte)0 );
+
+        return this;
+    }
+
+    /**
+     * Make the body of the message an array of numFds file descriptors.
+     */
+    RawMessageBuilder fileDescriptors( int numFds ){
+        m_numFds = numFds;
+        return this;
+    }
+
+    byte[] build(){
+        if( m_numFds > 0 ){
+            align( 8 );
+            m_buf.put( Message.HeaderField.SIGNATURE ).put( (byte)1 ).put( (byte)'g' ).put( (byte)0 );
+            m_buf.put( (byte)2 ).put( "ah".getBytes( StandardCharsets.US_ASCII ) ).put( (byte)0 );
+
+            align( 8 );
+            m_buf.put( Message.HeaderField.UNIX_FDS ).put( (byte)1 ).put( (byte)'u' ).put( (byte)0 );
+            m_buf.putInt( m_numFds );
+        }
+        m_buf.putInt( 12, m_buf.position() - 16 );
+
+        align( 8 );
+        int bodyStart = m_buf.position();
+        if( m_numFds > 0 ){
+            m_buf.putInt( 4 * m_numFds );
+            for( int x = 0; x < m_numFds; x++ ){
+                m_buf.putInt( x );
+            }
+        }
+        m_buf.putInt( 4, m_buf.position() - bodyStart );
+
+        return Arrays.copyOf( m_buf.array(), m_buf.position() );
+    }
+
+    private void align( int alignment ){
+        while( m_buf.position() % alignment != 0 ){
+            m_buf.put( (byte)0 );
+        }
+    }
+}
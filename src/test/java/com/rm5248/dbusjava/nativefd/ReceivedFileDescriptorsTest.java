@@ -0,0 +1,62 @@
+package com.rm5248.dbusjava.nativefd;
+
+import static org.junit.jupiter.api.Assertions.assertEquals;
+import static org.junit.jupiter.api.Assertions.assertSame;
+import static org.junit.jupiter.api.Assertions.assertThrows;
+import static org.junit.jupiter.api.Assertions.assertTrue;
+
+import java.util.List;
+import java.util.stream.Collectors;
+
+import org.freedesktop.dbus.FileDescriptor;
+import org.junit.jupiter.api.Test;
+
+/**
+ * The list of FDs of a received message wraps them lazily, but must still
+ * behave like a normal mutable list.
+ */
+public class ReceivedFileDescriptorsTest {
+
+    private static List<Integer> numbers( List<FileDescriptor> fds ){
+        return fds.stream().map( FileDescriptor::getIntFileDescriptor ).collect( Collectors.toList() );
+    }
+
+    @Test
+    public void testWrapsOnce(){
+        ReceivedFileDescriptors fds = new ReceivedFileDescriptors( new int[]{ 5, 6, 7 } );
+
+        assertEquals( 3, fds.size() );
+        assertSame( fds.get( 1 ), fds.get( 1 ) );
+        assertEquals( List.of( 5, 6, 7 ), numbers( fds ) );
+        assertThrows( IndexOutOfBoundsException.class, () -> fds.get( 3 ) );
+    }
+
+    @Test
+    public void testNoFileDescriptors(){
+        ReceivedFileDescriptors fds = new ReceivedFileDescriptors( null );
+
+        assertTrue( fds.isEmpty() );
+        fds.add( new FileDescriptor( 9 ) );
+        assertEquals( List.of( 9 ), numbers( fds ) );
+        // Other lists must not see the FD that was added
+        assertTrue( new ReceivedFileDescriptors( null ).isEmpty() );
+    }
+
+    @Test
+    public void testChanges(){
+        ReceivedFileDescriptors fds = new ReceivedFileDescriptors( new int[]{ 5, 6, 7 } );
+        FileDescriptor added = new FileDescriptor( 10 );
+
+        fds.add( 1, added );
+        fds.add( new FileDescriptor( 11 ) );
+        assertEquals( List.of( 5, 10, 6, 7, 11 ), numbers( fds ) );
+        assertSame( added, fds.get( 1 ) );
+
+        assertEquals( 6, fds.remove( 2 ).getIntFileDescriptor() );
+        fds.set( 0, new FileDescriptor( 12 ) );
+        assertEquals( List.of( 12, 10, 7, 11 ), numbers( fds ) );
+
+        fds.clear();
+        assertTrue( fds.isEmpty() );
+    }
+}
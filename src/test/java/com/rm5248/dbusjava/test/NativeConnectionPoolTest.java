@@ -0,0 +1,127 @@
+package com.rm5248.dbusjava.test;
+
+import static org.junit.jupiter.api.Assertions.assertEquals;
+import static org.junit.jupiter.api.Assertions.assertFalse;
+import static org.junit.jupiter.api.Assertions.assertNotNull;
+import static org.junit.jupiter.api.Assertions.assertSame;
+import static org.junit.jupiter.api.Assertions.assertTrue;
+
+import java.util.ArrayList;
+import java.util.HashSet;
+import java.util.List;
+import java.util.Set;
+import java.util.concurrent.CopyOnWriteArrayList;
+import java.util.concurrent.atomic.AtomicInteger;
+
+import org.freedesktop.dbus.connections.impl.DBusConnection;
+import org.freedesktop.dbus.connections.impl.DBusConnection.DBusBusType;
+import org.freedesktop.dbus.interfaces.DBusInterface;
+import org.junit.jupiter.api.AfterEach;
+import org.junit.jupiter.api.BeforeEach;
+import org.junit.jupiter.api.Test;
+
+import com.rm5248.dbusjava.nativefd.NativeConnection;
+import com.rm5248.dbusjava.nativefd.NativeConnectionPool;
+import com.rm5248.dbusjava.nativefd.NativeSocketProvider;
+
+public class NativeConnectionPoolTest {
+
+    private static final String OBJECT_PATH = "/com/rm5248/dbusjava/test/Counter";
+
+    private DBusConnection serviceConn;
+    private NativeConnectionPool pool;
+    private final AtomicInteger calls = new AtomicInteger();
+    private final List<Throwable> asyncExceptions = new CopyOnWriteArrayList<>();
+
+    @BeforeEach
+    public void before() throws Exception {
+        serviceConn = DBusConnection.newConnection( DBusBusType.SESSION );
+        serviceConn.exportObject( OBJECT_PATH, new CounterImpl() );
+        pool = new NativeConnectionPool( DBusBusType.SESSION, 4 );
+    }
+
+    @AfterEach
+    public void after() throws Exception {
+        pool.close();
+        serviceConn.close();
+    }
+
+    @Test
+    public void testThreadsShareConnections() throws Exception {
+        int numberOfThreads = 8;
+        int numberOfRequestsPerThread = 100;
+        Set<String> usedConnections = new HashSet<>();
+        List<Thread> threads = new ArrayList<>();
+
+        for( int x = 0; x < numberOfThreads; x++ ){
+            Thread thread = new Thread( () -> {
+                DBusConnection conn = pool.getConnection();
+                assertSame( conn, pool.getConnection() );
+                synchronized( usedConnections ){
+                    usedConnections.add( conn.getUniqueName() );
+                }
+
+                try{
+                    Counter counter = pool.getRemoteObject( serviceConn.getUniqueName(), OBJECT_PATH, Counter.class );
+                    for( int y = 0; y < numberOfRequestsPerThread; y++ ){
+                        counter.increment();
+                    }
+                } catch( Exception e ){
+                    throw new RuntimeException( e );
+                }
+            } );
+            thread.setUncaughtExceptionHandler( ( t, e ) -> asyncExceptions.add( e ) );
+            threads.add( thread );
+        }
+
+        threads.forEach( Thread::start );
+        for( Thread t : threads ){
+            t.join( 10_000 );
+        }
+
+        assertTrue( asyncExceptions.isEmpty(), "No exceptions expected" );
+        assertEquals( numberOfThreads * numberOfRequestsPerThread, calls.get() );
+        assertEquals( pool.size(), usedConnections.size() );
+    }
+
+    @Test
+    public void testPoolUsesNativeConnections() throws Exception {
+        int nativeConnections = 0;
+
+        for( NativeSocketProvider provider : NativeSocketProvider.getInstances() ){
+            for( NativeConnection connection : provider.getConnections() ){
+                assertNotNull( connection.getReader(), "Connection without a native reader" );
+                assertNotNull( connection.getWriter(), "Connection without a native writer" );
+                assertFalse( connection.isClosed() );
+                nativeConnections++;
+            }
+        }
+
+        // Every connection in the pool, plus the service connection
+        assertTrue( nativeConnections >= pool.size() + 1,
+                "Only " + nativeConnections + " native connections for a pool of " + pool.size() );
+    }
+
+    public interface Counter extends DBusInterface {
+
+        public void increment();
+    }
+
+    public class CounterImpl implements Counter {
+
+        @Override
+        public boolean isRemote() {
+            return false;
+        }
+
+        @Override
+        public String getObjectPath() {
+            return null;
+        }
+
+        @Override
+        public void increment() {
+            calls.incrementAndGet();
+        }
+    }
+}